@@ -0,0 +1,92 @@
+#!/bin/sh
+
+# Compare les performances de compare et de cmp (GNU) sur des fichiers de
+# tailles croissantes, avec la différence au début, au milieu, à la fin ou
+# sans différence, ainsi que sur des fichiers creux et sur un tube.
+#
+# Affiche un CSV sur la sortie standard, une ligne par mesure :
+#   taille,cas,programme,ms,debit_Mo_s,appels_systeme,defauts_mineurs,defauts_majeurs
+#
+# Le débit est la taille du fichier divisée par le temps écoulé. Le cache des
+# pages est chaud (les fichiers viennent d'être écrits). Les appels système
+# sont comptés lors d'une autre exécution, tracée (cf runstat.c).
+#
+# usage : ./bench.sh [taille...]    (suffixes K, M ou G, ex : 4K 1M 64M 1G)
+
+PROG="./compare"
+RUNSTAT="./runstat"
+TMP="/tmp/$$"
+TAILLES=${*:-"4K 1M 64M 1G"}
+
+# taille en octets
+octets ()
+{
+    case $1 in
+        *K) echo $(( ${1%K} * 1024 )) ;;
+        *M) echo $(( ${1%M} * 1024 * 1024 )) ;;
+        *G) echo $(( ${1%G} * 1024 * 1024 * 1024 )) ;;
+        *)  echo $1 ;;
+    esac
+}
+
+# remplace l'octet à la position $2 du fichier $1 par un octet différent
+modifier ()
+{
+    B=$(od -An -tu1 -j $2 -N1 $1 | tr -d ' ')
+    if [ "$B" = 65 ]; then C=B; else C=A; fi
+    printf $C | dd of=$1 bs=1 seek=$2 conv=notrunc status=none
+}
+
+# mesure une commande et affiche la ligne CSV : $1 taille, $2 cas, $3 pg
+mesurer ()
+{
+    T=$1 ; CAS=$2 ; NOM=$3
+    shift 3
+    set -- $($RUNSTAT "$@") $($RUNSTAT -s "$@")
+    MS=$1 ; MIN=$2 ; MAJ=$3 ; APPELS=$5
+    DEBIT=$(awk "BEGIN { printf \"%.1f\", $(octets $T) / 1048576 / ($MS / 1000) }")
+    echo "$T,$CAS,$NOM,$MS,$DEBIT,$APPELS,$MIN,$MAJ"
+}
+
+# mesure compare et cmp sur les fichiers $TMP/f1 et $TMP/f2
+mesurer_paire ()
+{
+    mesurer $1 $2 compare $PROG $TMP/f1 $TMP/f2
+    mesurer $1 $2 cmp     cmp $TMP/f1 $TMP/f2
+}
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+[ ! -x $RUNSTAT ] && echo "Il faut compiler '$RUNSTAT' (cf Makefile)" && exit 1
+
+mkdir $TMP
+
+echo "taille,cas,programme,ms,debit_Mo_s,appels_systeme,defauts_mineurs,defauts_majeurs"
+for T in $TAILLES; do
+    N=$(octets $T)
+    head -c $N /dev/urandom > $TMP/ref
+
+    for CAS in debut milieu fin aucune; do
+        cp $TMP/ref $TMP/f1 ; cp $TMP/ref $TMP/f2
+        case $CAS in
+            debut)  modifier $TMP/f2 0 ;;
+            milieu) modifier $TMP/f2 $(( N / 2 )) ;;
+            fin)    modifier $TMP/f2 $(( N - 1 )) ;;
+        esac
+        mesurer_paire $T $CAS
+    done
+
+    # fichiers creux identiques : un bloc de données au milieu de trous
+    rm -f $TMP/f1 $TMP/f2
+    truncate -s $N $TMP/f1
+    head -c 4096 $TMP/ref | dd of=$TMP/f1 bs=4096 seek=$(( N / 8192 )) conv=notrunc status=none
+    cp --sparse=always $TMP/f1 $TMP/f2
+    mesurer_paire $T creux
+
+    # second fichier lu depuis un tube, sans différence
+    mesurer $T tube compare sh -c "cat $TMP/ref | $PROG $TMP/ref /dev/stdin"
+    mesurer $T tube cmp     sh -c "cat $TMP/ref | cmp $TMP/ref -"
+
+    rm -f $TMP/ref $TMP/f1 $TMP/f2
+done
+
+rm -R $TMP
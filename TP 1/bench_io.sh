@@ -0,0 +1,49 @@
+#!/bin/sh
+
+# Compare les méthodes de lecture de compare (-i read, mmap, async) sur deux
+# fichiers identiques, avec le cache des pages froid puis chaud.
+#
+# usage : ./bench_io.sh [taille en Mo]
+
+PROG="./compare"
+TMP="/tmp/$$"
+SIZE=${1:-1024}
+
+# temps écoulé en ms pour la commande passée en argument
+duree_ms ()
+{
+    DEBUT=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    FIN=$(date +%s%N)
+    echo $(( (FIN - DEBUT) / 1000000 ))
+}
+
+# retire les fichiers du cache des pages (GNU dd)
+vider_cache ()
+{
+    for F in "$@"; do
+        dd if="$F" iflag=nocache count=0 status=none
+    done
+}
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+mkdir $TMP
+head -c ${SIZE}M /dev/urandom > $TMP/f1
+cp $TMP/f1 $TMP/f2
+
+echo "taille=${SIZE}Mo"
+printf "%-14s %10s %10s\n" "méthode" "froid(ms)" "chaud(ms)"
+for M in read mmap async async-thread; do
+    case $M in
+        async-thread) OPT="-i async"; export COMPARE_PREFETCH=thread ;;
+        *)            OPT="-i $M";    unset COMPARE_PREFETCH ;;
+    esac
+
+    vider_cache $TMP/f1 $TMP/f2
+    FROID=$(duree_ms $PROG $OPT $TMP/f1 $TMP/f2)
+    CHAUD=$(duree_ms $PROG $OPT $TMP/f1 $TMP/f2)
+    printf "%-14s %10s %10s\n" $M $FROID $CHAUD
+done
+
+rm -R $TMP
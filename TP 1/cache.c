@@ -0,0 +1,327 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compare.h"
+
+/*
+ * Persistent cache of the content hashes of regular files (-c cachefile).
+ *
+ * An entry holds a 128-bit hash of a file, keyed by its device and inode,
+ * and is only trusted if the size, modification and change times of the file
+ * are still those recorded. Any write to a file updates its change time,
+ * which can't be set back by the user, so a modified file is never matched.
+ *
+ * A file modified during the same clock tick as its hashing would keep the
+ * same times : such "racy" files, changed less than RACY_DELAY seconds before
+ * being hashed, are not stored.
+ *
+ * The cache is loaded at startup and written back (to a temporary file,
+ * then renamed) at exit if it was modified.
+ */
+
+#define CACHE_MAGIC 0x31434d43u // "CMC1"
+#define RACY_DELAY 2            // in seconds
+
+/// one file of the cache, as written on disk
+struct centry_s {
+    uint64_t dev, ino;
+    int64_t size;
+    int64_t mtime_s, mtime_ns;
+    int64_t ctime_s, ctime_ns;
+    uint64_t hash[2];
+};
+typedef struct centry_s centry_t;
+
+/// the cache : open addressing table indexed by (dev, ino)
+static struct {
+    const char *path; // NULL if there is no cache
+    centry_t *table;
+    size_t cap, nb;   // capacity (a power of 2) and number of entries
+    int dirty;        // the table must be written back
+    pthread_mutex_t lock;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/*
+ * 128-bit hash : four xxh64-like lanes over 32-byte stripes, folded into two
+ * 64-bit words. Not cryptographic, but fast and well mixed.
+ */
+
+#define P1 0x9e3779b185ebca87ull
+#define P2 0xc2b2ae3d27d4eb4full
+#define P3 0x165667b19e3779f9ull
+#define P4 0x85ebca77c2b2ae63ull
+#define P5 0x27d4eb2f165667c5ull
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t lane_round(uint64_t acc, uint64_t in) {
+    return rotl(acc + in * P2, 31) * P1;
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+struct hash_s {
+    uint64_t v[4];
+    uint64_t len;
+};
+
+static void hash_init(struct hash_s *h) {
+    h->v[0] = P1 + P2;
+    h->v[1] = P2;
+    h->v[2] = 0;
+    h->v[3] = -P1;
+    h->len = 0;
+}
+
+/**
+ * @brief hash a part of the data
+ *
+ * @param h the hash state
+ * @param p the data
+ * @param len size of the data, a multiple of 32 except for the last call
+ * @param out the final hash if this is the last call, NULL otherwise
+ */
+static void hash_update(struct hash_s *h, const unsigned char *p, size_t len,
+                        uint64_t out[2]) {
+    size_t i = 0;
+    uint64_t w;
+
+    h->len += len;
+    for (; i + 32 <= len; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            memcpy(&w, p + i + 8 * k, 8);
+            h->v[k] = lane_round(h->v[k], w);
+        }
+    }
+    if (out == NULL)
+        return;
+
+    uint64_t a = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) +
+                 rotl(h->v[3], 18);
+    uint64_t b = rotl(h->v[0], 19) + rotl(h->v[1], 13) + rotl(h->v[2], 8) +
+                 rotl(h->v[3], 2) + P5;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        a = rotl(a ^ lane_round(0, w), 27) * P1 + P4;
+        b = rotl(b ^ lane_round(P3, w), 29) * P2 + P1;
+    }
+    for (; i < len; i++) {
+        a = rotl(a ^ (p[i] * P5), 11) * P1;
+        b = rotl(b ^ (p[i] * P1), 13) * P2;
+    }
+
+    out[0] = avalanche(a ^ h->len);
+    out[1] = avalanche(b + out[0] + h->len * P4);
+}
+
+void hash_buf(const unsigned char *p, size_t len, uint64_t out[2]) {
+    struct hash_s h;
+
+    hash_init(&h);
+    hash_update(&h, p, len, out);
+}
+
+/**
+ * @brief hash a whole regular file
+ *
+ * @param fd file descriptor of the file
+ * @param size size of the file
+ * @param out the hash
+ * @return int - 0 on success, -1 if the file can't be mapped
+ */
+static int hash_file(int fd, off_t size, uint64_t out[2]) {
+    struct hash_s h;
+    off_t offset = 0;
+
+    hash_init(&h);
+    do {
+        size_t len = WINDOW;
+        if (size - offset < (off_t)WINDOW)
+            len = size - offset;
+        const unsigned char *w = len ? map_window(fd, offset, len) : NULL;
+        if (len != 0 && w == NULL)
+            return -1;
+
+        offset += len;
+        hash_update(&h, w, len, offset == size ? out : NULL);
+        if (w != NULL)
+            CHK(munmap((void *)w, len));
+    } while (offset < size);
+
+    return 0;
+}
+
+/*
+ * table
+ */
+
+static size_t slot_of(uint64_t dev, uint64_t ino, size_t cap) {
+    return avalanche(dev * P1 ^ ino) & (cap - 1);
+}
+
+/**
+ * @brief find the slot of a file, or the free slot where it would go
+ *
+ * @param dev device of the file
+ * @param ino inode of the file
+ * @return centry_t* - the slot (ino == 0 if it is free)
+ */
+static centry_t *find(uint64_t dev, uint64_t ino) {
+    size_t k = slot_of(dev, ino, cache.cap);
+
+    while (cache.table[k].ino != 0 &&
+           !(cache.table[k].dev == dev && cache.table[k].ino == ino))
+        k = (k + 1) & (cache.cap - 1);
+    return &cache.table[k];
+}
+
+static void grow(void) {
+    centry_t *old = cache.table;
+    size_t old_cap = cache.cap;
+
+    cache.cap = old_cap ? 2 * old_cap : 1024;
+    if ((cache.table = calloc(cache.cap, sizeof(centry_t))) == NULL)
+        raler(1, "calloc");
+    for (size_t k = 0; k < old_cap; k++)
+        if (old[k].ino != 0)
+            *find(old[k].dev, old[k].ino) = old[k];
+    free(old);
+}
+
+static void insert(const centry_t *e) {
+    if (2 * (cache.nb + 1) > cache.cap)
+        grow();
+
+    centry_t *slot = find(e->dev, e->ino);
+    if (slot->ino == 0)
+        cache.nb++;
+    *slot = *e;
+    cache.dirty = 1;
+}
+
+static void fill_key(centry_t *e, const struct stat *st) {
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime_s = st->st_mtim.tv_sec;
+    e->mtime_ns = st->st_mtim.tv_nsec;
+    e->ctime_s = st->st_ctim.tv_sec;
+    e->ctime_ns = st->st_ctim.tv_nsec;
+}
+
+/*
+ * interface
+ */
+
+void cache_open(const char *path) {
+    uint32_t header[2]; // magic, unused
+    centry_t e;
+    FILE *f;
+
+    cache.path = path;
+    grow();
+
+    // a missing or unreadable cache is only an empty one
+    if ((f = fopen(path, "r")) == NULL)
+        return;
+    if (fread(header, sizeof(header), 1, f) == 1 && header[0] == CACHE_MAGIC)
+        while (fread(&e, sizeof(e), 1, f) == 1)
+            if (e.ino != 0)
+                insert(&e);
+    fclose(f);
+    cache.dirty = 0;
+}
+
+void cache_close(void) {
+    uint32_t header[2] = {CACHE_MAGIC, 0};
+    char tmp[PATH_MAX];
+    FILE *f;
+    int n;
+
+    if (cache.path == NULL)
+        return;
+
+    if (cache.dirty) {
+        n = snprintf(tmp, sizeof(tmp), "%s.%jd", cache.path,
+                     (intmax_t)getpid());
+        if (n < 0 || n >= (int)sizeof(tmp))
+            raler(0, "cache path too long: %s", cache.path);
+        if ((f = fopen(tmp, "w")) == NULL)
+            raler(1, "%s", tmp);
+        if (fwrite(header, sizeof(header), 1, f) != 1)
+            raler(1, "writing %s", tmp);
+        for (size_t k = 0; k < cache.cap; k++)
+            if (cache.table[k].ino != 0 &&
+                fwrite(&cache.table[k], sizeof(centry_t), 1, f) != 1)
+                raler(1, "writing %s", tmp);
+        if (fclose(f) == EOF)
+            raler(1, "writing %s", tmp);
+        CHK(rename(tmp, cache.path));
+    }
+
+    free(cache.table);
+    cache.table = NULL;
+    cache.path = NULL;
+}
+
+int cache_enabled(void) { return cache.path != NULL; }
+
+int cache_lookup(const struct stat *st, uint64_t hash[2]) {
+    centry_t key;
+    int found;
+
+    fill_key(&key, st);
+    pthread_mutex_lock(&cache.lock);
+    centry_t *e = find(key.dev, key.ino);
+    found = e->ino != 0 && e->size == key.size && e->mtime_s == key.mtime_s &&
+            e->mtime_ns == key.mtime_ns && e->ctime_s == key.ctime_s &&
+            e->ctime_ns == key.ctime_ns;
+    if (found)
+        memcpy(hash, e->hash, sizeof(e->hash));
+    pthread_mutex_unlock(&cache.lock);
+
+    return found;
+}
+
+int cache_store(int fd, const struct stat *st, uint64_t hash[2], int known) {
+    struct stat after;
+    centry_t e;
+
+    if (!known && hash_file(fd, st->st_size, hash) == -1)
+        return -1;
+
+    // the file must not have changed since st, nor be too recent to tell
+    CHK(fstat(fd, &after));
+    if (after.st_size != st->st_size ||
+        after.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+        after.st_mtim.tv_nsec != st->st_mtim.tv_nsec ||
+        after.st_ctim.tv_sec != st->st_ctim.tv_sec ||
+        after.st_ctim.tv_nsec != st->st_ctim.tv_nsec ||
+        after.st_ctim.tv_sec > time(NULL) - RACY_DELAY)
+        return 0;
+
+    fill_key(&e, st);
+    memcpy(e.hash, hash, sizeof(e.hash));
+    pthread_mutex_lock(&cache.lock);
+    insert(&e);
+    pthread_mutex_unlock(&cache.lock);
+    return 0;
+}
@@ -1,19 +1,34 @@
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define BUFSIZE 4096ul
+#include "compare.h"
+#include "kernels.h"
+
+#define USAGE                                                                \
+    "Usage: %s [-c cachefile] [-i method] [-j jobs] [-r] [-s] file1 file2 "  \
+    "[file...]\n"                                                            \
+    "       %s -d|--delta deltafile [-s] file1 file2\n"                      \
+    "       %s -a|--apply deltafile file1 file2"
 
-#define CHK(op)            \
-    do {                   \
-        if ((op) == -1)    \
-            raler(1, #op); \
-    } while (0)
+/// long names of the options
+static const struct option longopts[] = {
+    {"apply", required_argument, NULL, 'a'},
+    {"delta", required_argument, NULL, 'd'},
+    {NULL, 0, NULL, 0},
+};
 
 noreturn void raler(int syserr, const char *msg, ...) {
     va_list ap;
@@ -30,65 +45,94 @@ noreturn void raler(int syserr, const char *msg, ...) {
 }
 
 /**
- * @brief compare two buffers
+ * @brief print the message of a comparison, as cmp does
  *
- * @param buf1 buffer 1
- * @param buf2 buffer 2
- * @param size size of the shortest buffer
- * @return ssize_t - position of the byte that differs or -1 if buffers are
- * equals
+ * @param out where to print the message
+ * @param res outcome of the comparison
+ * @param filename1 name of the first file
+ * @param filename2 name of the second file
  */
-ssize_t buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
-                ssize_t size) {
-    for (ssize_t i = 0; i < size; i++)
-        if (buf1[i] != buf2[i])
-            return i;
+void print_result(FILE *out, const result_t *res, const char *filename1,
+                  const char *filename2) {
+    const char *f = res->which == 0 ? filename1 : filename2;
 
-    return -1;
+    switch (res->verdict) {
+    case SAME:
+        break;
+    case DIFFER:
+        fprintf(out, "%s %s differ: byte %jd, line %jd\n", filename1,
+                filename2, (intmax_t)res->byte, (intmax_t)res->line);
+        break;
+    case EOF_EMPTY:
+        fprintf(out, "EOF on %s which is empty\n", f);
+        break;
+    case EOF_AFTER:
+        fprintf(out, "EOF on %s after byte %jd, line %jd\n", f,
+                (intmax_t)res->byte, (intmax_t)res->line);
+        break;
+    }
 }
 
 /**
- * @brief count number of newlines in buffer
+ * @brief fill a buffer, unless the end of file is reached
  *
- * @param buf buffer
- * @param size size of buffer
- * @return ssize_t - number of newlines
+ * @note pipes and ttys can return less than asked for, which must not be
+ * mistaken for the end of the file
+ * @param fd file descriptor to read from
+ * @param buf buffer to fill
+ * @param size size of the buffer
+ * @return ssize_t - number of bytes read (< size only at the end of file)
  */
-ssize_t count_nl(const unsigned char *buf, ssize_t size) {
-    ssize_t nl = 0;
+ssize_t read_full(int fd, unsigned char *buf, size_t size) {
+    size_t done = 0;
+    ssize_t n;
 
-    for (ssize_t i = 0; i < size; i++)
-        if (buf[i] == '\n')
-            nl++;
+    while (done < size) {
+        CHK(n = read(fd, buf + done, size - done));
+        if (n == 0)
+            break;
+        done += n;
+    }
 
-    return nl;
+    return done;
 }
 
 /**
- * @brief compare two files
+ * @brief compare two files block by block, works on any kind of file
  *
  * @param fd1 file descriptor of the first file
  * @param fd2 file descriptor of the second file
- * @param filename1 name of the first file
- * @param filename2 name of the second file
+ * @param async 1 to read ahead with the prefetching reader, 0 to read()
+ * 4 KiB at a time in between the comparisons
+ * @param res outcome of the comparison
  * @return int - 0 if the files are identical, 1 otherwise
  */
-int compare(int fd1, int fd2, const char *filename1, const char *filename2) {
-    unsigned char buf1[BUFSIZE];
-    unsigned char buf2[BUFSIZE];
-    ssize_t nread1 = -1, nread2 = -1;
+int compare_read(int fd1, int fd2, int async, result_t *res) {
+    unsigned char rbuf1[BUFSIZE];
+    unsigned char rbuf2[BUFSIZE];
+    const unsigned char *bufs[2] = {rbuf1, rbuf2};
+    ssize_t nreads[2] = {-1, -1};
     ssize_t bytes_read = 0;  // number of bytes read from the file
     ssize_t line_number = 1; // number of the line (starts from 1)
+    prefetch_t *pf = async ? prefetch_open(fd1, fd2) : NULL;
+
+    res->verdict = SAME;
 
-    while (!(nread1 == 0 && nread2 == 0)) {
-        CHK(nread1 = read(fd1, buf1, BUFSIZE));
-        CHK(nread2 = read(fd2, buf2, BUFSIZE));
+    while (!(nreads[0] == 0 && nreads[1] == 0)) {
+        if (pf != NULL) {
+            prefetch_next(pf, bufs, nreads);
+        } else {
+            nreads[0] = read_full(fd1, rbuf1, BUFSIZE);
+            nreads[1] = read_full(fd2, rbuf2, BUFSIZE);
+        }
+        const unsigned char *buf1 = bufs[0], *buf2 = bufs[1];
+        ssize_t nread1 = nreads[0], nread2 = nreads[1];
 
         // if we reached the end of the file at the beginning
         if (bytes_read == 0 && nread1 * nread2 == 0 && nread1 != nread2) {
-            fprintf(stderr, "EOF on %s which is empty\n",
-                    nread1 == 0 ? filename1 : filename2);
-            return 1;
+            res->verdict = EOF_EMPTY;
+            res->which = nread1 == 0 ? 0 : 1;
+            break;
         }
 
         // assume buffers are not the same length
@@ -96,50 +140,395 @@ int compare(int fd1, int fd2, const char *filename1, const char *filename2) {
             nread1 < nread2 ? nread1 : nread2;
         const unsigned char *buf_shorter = // shorter buffer
             nread1 < nread2 ? buf1 : buf2;
-        const char *f1 = // shorter file name
-            nread1 < nread2 ? filename1 : filename2;
+        int f1 = // shorter file
+            nread1 < nread2 ? 0 : 1;
 
         // check if buffers are the same at least partially
         ssize_t cmp = buf_cmp(buf1, buf2, shorter);
         if (cmp >= 0) {
             bytes_read += cmp + 1; // add 1 because we start counting from 0
             line_number += count_nl(buf_shorter, cmp);
-            fprintf(stderr, "%s %s differ: byte %ld, line %ld\n", filename1,
-                    filename2, bytes_read, line_number);
-            return 1;
+            res->verdict = DIFFER;
+            res->byte = bytes_read;
+            res->line = line_number;
+            break;
         }
 
         // if buffers are partially the same, but are not the same length
         if (nread1 != nread2) {
             bytes_read += shorter;
             line_number += count_nl(buf_shorter, shorter);
-            fprintf(stderr, "EOF on %s after byte %ld, line %ld\n", f1,
-                    bytes_read, line_number);
-            return 1;
+            res->verdict = EOF_AFTER;
+            res->which = f1;
+            res->byte = bytes_read;
+            res->line = line_number;
+            break;
         }
 
         // if buffers are the same
         bytes_read += nread1;
         line_number += count_nl(buf1, nread1);
     } // main loop
+
+    if (pf != NULL)
+        prefetch_close(pf);
+    return res->verdict != SAME;
+}
+
+/**
+ * @brief map a window of a file for a single sequential pass
+ *
+ * @param fd file descriptor of the file
+ * @param offset offset of the window (multiple of the page size)
+ * @param len length of the window
+ * @return const unsigned char* - the window or NULL if it can't be mapped
+ */
+const unsigned char *map_window(int fd, off_t offset, size_t len) {
+    void *p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, offset);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    // only an hint, the comparison is still correct if it fails
+    (void)madvise(p, len, MADV_SEQUENTIAL);
+    return p;
+}
+
+/**
+ * @brief find the extent of a regular file starting at an offset
+ *
+ * The extents are widened to whole pages, so that they can be mapped : the
+ * part of a page which is a hole is then read as data, zeros as it should.
+ *
+ * @param fd file descriptor of the file
+ * @param offset start of the extent (multiple of the page size)
+ * @param size size of the file
+ * @param end end of the extent (> offset)
+ * @return int - 1 if the extent holds data, 0 if it is a hole
+ */
+static int extent(int fd, off_t offset, off_t size, off_t *end) {
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t data, hole;
+
+    if ((data = lseek(fd, offset, SEEK_DATA)) == -1) {
+        if (errno != ENXIO) {
+            *end = size; // holes not supported here, all data
+            return 1;
+        }
+        data = size; // a hole up to the end of the file
+    }
+
+    if (data - data % page > offset) {
+        *end = data - data % page;
+        return 0;
+    }
+
+    // from the data itself, the hole may start before data in the same page
+    if ((hole = lseek(fd, data, SEEK_HOLE)) == -1)
+        hole = size;
+    hole = (hole + page - 1) / page * page;
+    *end = hole < size ? hole : size;
+    return 1;
+}
+
+/**
+ * @brief map a window of a file, or of zeros if it is a hole
+ *
+ * @param fd file descriptor of the file
+ * @param offset offset of the window (multiple of the page size)
+ * @param len length of the window
+ * @param data 1 if the window holds data, 0 if it is a hole
+ * @return const unsigned char* - the window or NULL if it can't be mapped
+ */
+static const unsigned char *map_extent(int fd, off_t offset, size_t len,
+                                       int data) {
+    if (data)
+        return map_window(fd, offset, len);
+
+    // every page of it is the zero page, never written
+    void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * @brief compare two regular files in place, window by window
+ *
+ * The sizes are known beforehand, so only the common prefix is ever mapped :
+ * when they differ, the files can't be identical and what is left to find
+ * is whether they differ before the end of the shorter one.
+ *
+ * The files are walked extent by extent (lseek() SEEK_DATA and SEEK_HOLE) :
+ * holes facing holes are identical without reading anything, and data facing
+ * a hole is compared against zeros. Holes contain no newline.
+ *
+ * @param fd1 file descriptor of the first file
+ * @param fd2 file descriptor of the second file
+ * @param size1 size of the first file (> 0)
+ * @param size2 size of the second file (> 0)
+ * @param res outcome of the comparison
+ * @return int - 0 if the files are identical, 1 otherwise, -1 if the first
+ * window could not be mapped (nothing has been printed then)
+ */
+int compare_mmap(int fd1, int fd2, off_t size1, off_t size2,
+                 result_t *res) {
+    off_t shorter = size1 < size2 ? size1 : size2;
+    off_t offset = 0;
+    off_t end1 = 0, end2 = 0; // end of the current extent of each file
+    int data1 = 1, data2 = 1; // current extents hold data
+    int mapped = 0;           // a window has already been compared
+    ssize_t line_number = 1;  // number of the line (starts from 1)
+
+    while (offset < shorter) {
+        if (offset >= end1)
+            data1 = extent(fd1, offset, size1, &end1);
+        if (offset >= end2)
+            data2 = extent(fd2, offset, size2, &end2);
+
+        off_t end = end1 < end2 ? end1 : end2;
+        if (end > shorter)
+            end = shorter;
+        if (!data1 && !data2) {
+            offset = end;
+            continue;
+        }
+
+        size_t len = WINDOW;
+        if (end - offset < (off_t)WINDOW)
+            len = end - offset;
+        const unsigned char *w1 = map_extent(fd1, offset, len, data1);
+        const unsigned char *w2 = w1 ? map_extent(fd2, offset, len, data2)
+                                     : NULL;
+
+        if (w2 == NULL) {
+            if (!mapped) {
+                if (w1 != NULL)
+                    CHK(munmap((void *)w1, len));
+                return -1;
+            }
+            raler(1, "mmap at offset %jd", (intmax_t)offset);
+        }
+        mapped = 1;
+
+        ssize_t cmp = buf_cmp(w1, w2, len);
+        line_number += count_nl(w1, cmp >= 0 ? cmp : (ssize_t)len);
+
+        CHK(munmap((void *)w1, len));
+        CHK(munmap((void *)w2, len));
+
+        if (cmp >= 0) {
+            res->verdict = DIFFER;
+            res->byte = offset + cmp + 1;
+            res->line = line_number;
+            return 1;
+        }
+
+        offset += len;
+    }
+
+    if (size1 != size2) {
+        res->verdict = EOF_AFTER;
+        res->which = size1 < size2 ? 0 : 1;
+        res->byte = shorter;
+        res->line = line_number;
+        return 1;
+    }
+
+    res->verdict = SAME;
     return 0;
 }
 
+/**
+ * @brief compare the contents of two files, in place when both are regular
+ * files that can be mapped, with read() otherwise (pipes, ttys, empty or
+ * special files)
+ *
+ * @param fd1 file descriptor of the first file
+ * @param fd2 file descriptor of the second file
+ * @param st1 status of the first file
+ * @param st2 status of the second file
+ * @param opts how to compare the files
+ * @param res outcome of the comparison
+ * @return int - 0 if the files are identical, 1 otherwise
+ */
+int compare_contents(int fd1, int fd2, const struct stat *st1,
+                     const struct stat *st2, const options_t *opts,
+                     result_t *res) {
+    if (opts->method != METHOD_MMAP)
+        return compare_read(fd1, fd2, opts->method == METHOD_ASYNC, res);
+
+    // empty regular files may still have contents (/proc), let read() decide
+    if (S_ISREG(st1->st_mode) && S_ISREG(st2->st_mode) && st1->st_size > 0 &&
+        st2->st_size > 0) {
+        int r = -1;
+        // the threads would read the holes, a single pass skips them
+        int sparse = st1->st_blocks * 512 < st1->st_size ||
+                     st2->st_blocks * 512 < st2->st_size;
+        if (opts->jobs > 1 && !sparse)
+            r = compare_parallel(fd1, fd2, opts->jobs, res);
+        if (r == -1)
+            r = compare_mmap(fd1, fd2, st1->st_size, st2->st_size, res);
+        if (r >= 0)
+            return r;
+    }
+
+    return compare_read(fd1, fd2, 0, res);
+}
+
+/**
+ * @brief compare two files, through the hash cache when there is one
+ *
+ * @param fd1 file descriptor of the first file
+ * @param fd2 file descriptor of the second file
+ * @param opts how to compare the files
+ * @param res outcome of the comparison
+ * @return int - 0 if the files are identical, 1 otherwise
+ */
+int compare(int fd1, int fd2, const options_t *opts, result_t *res) {
+    struct stat st1, st2;
+    uint64_t h1[2], h2[2];
+    int c1 = 0, c2 = 0; // hash of the file found in the cache
+    int r;
+
+    CHK(fstat(fd1, &st1));
+    CHK(fstat(fd2, &st2));
+
+    // the same regular file twice (or two hard links) is surely identical
+    if (S_ISREG(st1.st_mode) && st1.st_dev == st2.st_dev &&
+        st1.st_ino == st2.st_ino) {
+        res->verdict = SAME;
+        return 0;
+    }
+
+    int cached = cache_enabled() && S_ISREG(st1.st_mode) &&
+                 S_ISREG(st2.st_mode);
+    if (cached) {
+        c1 = cache_lookup(&st1, h1);
+        c2 = cache_lookup(&st2, h2);
+        if (c1 && c2 && h1[0] == h2[0] && h1[1] == h2[1]) {
+            res->verdict = SAME;
+            return 0;
+        }
+        // different hashes, but where ? only worth reading if it is printed
+        if (c1 && c2 && opts->silent) {
+            res->verdict = DIFFER;
+            res->byte = res->line = 0;
+            return 1;
+        }
+    }
+
+    r = compare_contents(fd1, fd2, &st1, &st2, opts, res);
+
+    // record the files the cache did not know, identical files share a hash
+    if (cached && r == 0) {
+        if (c1)
+            cache_store(fd2, &st2, h1, 1);
+        else if (c2)
+            cache_store(fd1, &st1, h2, 1);
+        else if (cache_store(fd1, &st1, h1, 0) == 0)
+            cache_store(fd2, &st2, h1, 1);
+    } else if (cached) {
+        if (!c1)
+            cache_store(fd1, &st1, h1, 0);
+        if (!c2)
+            cache_store(fd2, &st2, h2, 0);
+    }
+
+    return r;
+}
+
 int main(int argc, char *argv[]) {
     int fd1, fd2;
     int result;
+    options_t opts = {METHOD_MMAP, 0, 0};
+    const char *cachefile = NULL; // hash cache (-c)
+    int recursive = 0;            // compare directory trees (-r)
+    const char *delta = NULL;     // write the delta of the files (-d)
+    const char *patch = NULL;     // apply a delta (-a)
+    result_t res;
+    char *endptr;
+    long jobs;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "a:c:d:i:j:rs", longopts, NULL)) !=
+           -1) {
+        switch (opt) {
+        case 'a':
+            patch = optarg;
+            break;
+        case 'c':
+            cachefile = optarg;
+            break;
+        case 'd':
+            delta = optarg;
+            break;
+        case 'i':
+            if (strcmp(optarg, "mmap") == 0)
+                opts.method = METHOD_MMAP;
+            else if (strcmp(optarg, "read") == 0)
+                opts.method = METHOD_READ;
+            else if (strcmp(optarg, "async") == 0)
+                opts.method = METHOD_ASYNC;
+            else
+                raler(0, "bad input method: %s (mmap, read or async)",
+                      optarg);
+            break;
+        case 'j':
+            jobs = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr != '\0' || jobs < 1 ||
+                jobs > 1024)
+                raler(0, "bad number of jobs: %s", optarg);
+            opts.jobs = jobs;
+            break;
+        case 'r':
+            recursive = 1;
+            break;
+        case 's':
+            opts.silent = 1;
+            break;
+        default:
+            raler(0, USAGE, argv[0], argv[0], argv[0]);
+        }
+    }
 
     // because argv[0] is always defined
-    if (argc != 3) {
-        raler(0, "Usage: %s file1 file2", argv[0]);
+    if (argc - optind < 2 ||
+        ((recursive || delta || patch) && argc - optind != 2) ||
+        (patch && (delta || recursive)) || (delta && recursive)) {
+        raler(0, USAGE, argv[0], argv[0], argv[0]);
     }
+    const char *filename1 = argv[optind], *filename2 = argv[optind + 1];
 
-    CHK(fd1 = open(argv[1], O_RDONLY));
-    CHK(fd2 = open(argv[2], O_RDONLY));
+    kernels_init(); // pick the fastest buf_cmp() and count_nl() for this cpu
+    if (cachefile != NULL)
+        cache_open(cachefile);
 
-    result = compare(fd1, fd2, argv[1], argv[2]);
+    if (patch) {
+        apply_delta(patch, filename1, filename2);
+        result = 0;
+    } else if (delta) {
+        result = compare_delta(filename1, filename2, delta, &opts);
+    } else if (recursive) {
+        // the threads compare different pairs of files, one cpu each
+        if (opts.jobs == 0)
+            opts.jobs = sysconf(_SC_NPROCESSORS_ONLN) > 0
+                            ? sysconf(_SC_NPROCESSORS_ONLN)
+                            : 1;
+        result = compare_tree(filename1, filename2, &opts);
+    } else if (argc - optind > 2) {
+        // file1 is the reference, read once for all the others
+        result = compare_multi(filename1, argv + optind + 1, argc - optind - 1,
+                               &opts);
+    } else {
+        CHK(fd1 = open(filename1, O_RDONLY));
+        CHK(fd2 = open(filename2, O_RDONLY));
+
+        result = compare(fd1, fd2, &opts, &res);
+        if (!opts.silent)
+            print_result(stderr, &res, filename1, filename2);
+
+        CHK(close(fd1));
+        CHK(close(fd2));
+    }
 
-    CHK(close(fd1));
-    CHK(close(fd2));
+    cache_close();
     return result;
 }
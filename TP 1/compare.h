@@ -0,0 +1,109 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdnoreturn.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define BUFSIZE 4096ul
+#define WINDOW (64ul << 20) // size of the mapped windows (multiple of a page)
+
+#define CHK(op)            \
+    do {                   \
+        if ((op) == -1)    \
+            raler(1, #op); \
+    } while (0)
+
+// print an error message (and errno if syserr == 1) then exit(1)
+noreturn void raler(int syserr, const char *msg, ...);
+
+// fill a buffer with read(), unless the end of file is reached
+ssize_t read_full(int fd, unsigned char *buf, size_t size);
+
+// map a window of a file for a single sequential pass, NULL on failure
+const unsigned char *map_window(int fd, off_t offset, size_t len);
+
+/// outcome of a comparison, printed with print_result()
+struct result_s {
+    enum verdict_e {
+        SAME,      // the files are identical
+        DIFFER,    // byte is the first differing byte
+        EOF_EMPTY, // the file which is empty
+        EOF_AFTER, // the file which ends after byte, the other goes on
+    } verdict;
+    int which;  // for EOF_*, 0 for the first file, 1 for the second
+    off_t byte; // differing byte or last common byte (counted from 1)
+    off_t line; // line of that byte (counted from 1)
+};
+typedef struct result_s result_t;
+
+// print the message of a comparison (nothing if the files are identical)
+void print_result(FILE *out, const result_t *res, const char *filename1,
+                  const char *filename2);
+
+/// how the files are read (-i)
+enum method_e {
+    METHOD_MMAP,  // mmap for regular files, read() for the others
+    METHOD_READ,  // read() only
+    METHOD_ASYNC, // prefetching reader (io_uring or threads)
+};
+
+/// settings of a comparison, from the command line
+struct options_s {
+    enum method_e method; // how the files are read (-i)
+    int jobs;             // number of threads (-j)
+    int silent;           // only the exit code matters, no message (-s)
+};
+typedef struct options_s options_t;
+
+// compare two files : 0 if identical, 1 otherwise
+int compare(int fd1, int fd2, const options_t *opts, result_t *res);
+
+// compare two regular files with jobs threads, -1 if they can't be mapped
+int compare_parallel(int fd1, int fd2, int jobs, result_t *res);
+
+// compare two directory trees with a pool of threads (tree.c)
+int compare_tree(const char *dir1, const char *dir2, const options_t *opts);
+
+// compare a reference file against nb others in a single pass (multi.c)
+int compare_multi(const char *ref, char *const names[], int nb,
+                  const options_t *opts);
+
+// persistent cache of file hashes (cache.c)
+void cache_open(const char *path);
+void cache_close(void);
+int cache_enabled(void);
+
+// 1 and the hash of the file described by st if the cache knows it
+int cache_lookup(const struct stat *st, uint64_t hash[2]);
+
+// hash (unless known) and record a file, -1 if it could not be hashed
+int cache_store(int fd, const struct stat *st, uint64_t hash[2], int known);
+
+// 128-bit hash of a buffer, the one of the cache
+void hash_buf(const unsigned char *p, size_t len, uint64_t out[2]);
+
+// report the differing regions of two files and write a delta from the first
+// to the second in deltafile ("-" for the standard output) (delta.c)
+int compare_delta(const char *filename1, const char *filename2,
+                  const char *deltafile, const options_t *opts);
+
+// rebuild the second file from the first one and a delta
+void apply_delta(const char *deltafile, const char *filename1,
+                 const char *filename2);
+
+// asynchronous reader of a pair of files (prefetch.c)
+typedef struct prefetch_s prefetch_t;
+
+// start reading ahead both files
+prefetch_t *prefetch_open(int fd1, int fd2);
+
+// hand over the next block of each file, the previous ones are given back
+void prefetch_next(prefetch_t *pf, const unsigned char *buf[2], ssize_t n[2]);
+
+// stop reading ahead and free the reader
+void prefetch_close(prefetch_t *pf);
+
+#endif
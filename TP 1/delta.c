@@ -0,0 +1,500 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compare.h"
+
+/*
+ * Delta between two files (-d deltafile), as rsync computes it.
+ *
+ * The first file is read once and cut into blocks, each one indexed by a
+ * weak rolling checksum and a strong 128-bit hash. The second file is then
+ * streamed through a window of a block : the weak checksum of the window is
+ * rolled byte by byte, and the window is looked up in the index, where the
+ * strong hash settles the weak matches. A match becomes a copy of the block,
+ * the bytes in between become literals.
+ *
+ * The memory only depends on the number of blocks of the first file, both
+ * files are read sequentially (they can be pipes), and every differing region
+ * is reported as soon as the copy which ends it is found :
+ *      file1 file2 differ: bytes A-B replaced by bytes C-D
+ *      file1 file2 differ: bytes A-B deleted before byte C
+ *      file1 file2 differ: bytes C-D inserted before byte A
+ * where A-B are bytes of the first file and C-D of the second one. Regions
+ * are as precise as the blocks.
+ *
+ * The delta is a header then a list of operations, integers being written
+ * as LEB128 varints :
+ *      'C' offset length  copy bytes of the first file
+ *      'L' length bytes   literal bytes
+ *      'E' size           end, size of the second file
+ */
+
+#define DELTA_MAGIC 0x31444d43u // "CMD1"
+#define MIN_BLOCK 512l          // bounds of the size of a block
+#define MAX_BLOCK (1l << 20)
+#define PIPE_BLOCK 4096l        // size of a block when the file size is unknown
+#define NIL UINT32_MAX          // end of a chain of the index
+
+/// a block of the first file
+struct block_s {
+    uint32_t weak;      // rolling checksum
+    uint32_t next;      // next block of the chain with the same bucket
+    uint64_t strong[2]; // 128-bit hash
+};
+
+/// the blocks of the first file, chained by weak checksum
+struct index_s {
+    size_t bsize;           // size of a block
+    struct block_s *blocks; // in the order of the file
+    uint32_t nb, cap;       // number of blocks, the last one may be short
+    size_t tail;            // size of the last block if it is short, else 0
+    uint32_t *heads;        // first block of each bucket (NIL if none)
+    uint32_t mask;          // number of buckets - 1
+};
+typedef struct index_s index_t;
+
+/// the delta being written and the regions being reported
+struct delta_s {
+    const char *f1, *f2; // names of the files
+    FILE *out;           // the delta
+    int silent;          // no report
+    int differ;          // a region has been reported
+    off_t p1;            // next byte of the first file expected to be copied
+    off_t o2;            // byte of the second file where the literals start
+    off_t lit;           // number of literal bytes since the last copy
+    off_t src, len;      // copy not written yet, to be merged with the next
+};
+typedef struct delta_s delta_t;
+
+/*
+ * checksums
+ */
+
+/**
+ * @brief weak checksum of a buffer, with its two halves to roll it
+ *
+ * @param p the buffer
+ * @param n size of the buffer
+ * @param a sum of the bytes
+ * @param b sum of the bytes weighted by their distance to the end
+ */
+static void weak_init(const unsigned char *p, size_t n, uint32_t *a,
+                      uint32_t *b) {
+    uint32_t sa = 0, sb = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sa += p[i];
+        sb += (uint32_t)(n - i) * p[i];
+    }
+    *a = sa;
+    *b = sb;
+}
+
+static inline uint32_t weak_of(uint32_t a, uint32_t b) {
+    return (a & 0xffff) | (b << 16);
+}
+
+static inline uint32_t bucket_of(uint32_t weak, uint32_t mask) {
+    return (weak * 0x9e3779b1u) >> 7 & mask;
+}
+
+/*
+ * varints
+ */
+
+static void put_varint(FILE *f, uint64_t v) {
+    do {
+        unsigned char c = v & 0x7f;
+        v >>= 7;
+        putc(v ? c | 0x80 : c, f);
+    } while (v);
+}
+
+static uint64_t get_varint(FILE *f, const char *name) {
+    uint64_t v = 0;
+    int c, shift = 0;
+
+    do {
+        if ((c = getc(f)) == EOF || shift > 63)
+            raler(0, "%s: truncated delta", name);
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return v;
+}
+
+/*
+ * index of the first file
+ */
+
+/**
+ * @brief size of the blocks of a file, the power of 2 about the square root
+ * of its size
+ *
+ * @param fd file descriptor of the file
+ * @return size_t - size of a block
+ */
+static size_t block_size(int fd) {
+    struct stat st;
+    long b = MIN_BLOCK;
+
+    CHK(fstat(fd, &st));
+    if (!S_ISREG(st.st_mode))
+        return PIPE_BLOCK;
+
+    while (b < MAX_BLOCK && b * b < st.st_size)
+        b *= 2;
+    return b;
+}
+
+/**
+ * @brief read the first file and index its blocks
+ *
+ * @param idx the index
+ * @param fd file descriptor of the first file
+ * @return off_t - size of the first file
+ */
+static off_t build_index(index_t *idx, int fd) {
+    unsigned char *buf;
+    uint32_t a, b;
+    off_t size = 0;
+    ssize_t n;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->bsize = block_size(fd);
+    if ((buf = malloc(idx->bsize)) == NULL)
+        raler(1, "malloc");
+
+    while ((n = read_full(fd, buf, idx->bsize)) > 0) {
+        if (idx->nb == idx->cap) {
+            idx->cap = idx->cap ? 2 * idx->cap : 1024;
+            if (idx->cap >= NIL)
+                raler(0, "too many blocks");
+            idx->blocks =
+                realloc(idx->blocks, idx->cap * sizeof(struct block_s));
+            if (idx->blocks == NULL)
+                raler(1, "realloc");
+        }
+
+        struct block_s *blk = &idx->blocks[idx->nb++];
+        weak_init(buf, n, &a, &b);
+        blk->weak = weak_of(a, b);
+        hash_buf(buf, n, blk->strong);
+        size += n;
+        if ((size_t)n < idx->bsize) {
+            idx->tail = n;
+            break;
+        }
+    }
+    free(buf);
+
+    // the short last block is only looked for at the end of the second file
+    uint32_t full = idx->nb - (idx->tail != 0);
+    uint32_t nbuckets = 1024;
+    while (nbuckets < 2 * full)
+        nbuckets *= 2;
+    idx->mask = nbuckets - 1;
+    if ((idx->heads = malloc(nbuckets * sizeof(uint32_t))) == NULL)
+        raler(1, "malloc");
+    memset(idx->heads, 0xff, nbuckets * sizeof(uint32_t));
+
+    // same blocks are chained once (the first one), keeping the chains short
+    for (uint32_t k = 0; k < full; k++) {
+        struct block_s *blk = &idx->blocks[k];
+        uint32_t *head = &idx->heads[bucket_of(blk->weak, idx->mask)];
+        uint32_t o = *head;
+
+        while (o != NIL && (idx->blocks[o].weak != blk->weak ||
+                            memcmp(idx->blocks[o].strong, blk->strong,
+                                   sizeof(blk->strong)) != 0))
+            o = idx->blocks[o].next;
+        blk->next = NIL;
+        if (o == NIL) {
+            blk->next = *head;
+            *head = k;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * @brief find a block of the first file identical to a window
+ *
+ * The block expected after the last copy is tried first, so that identical
+ * files are copied in order whatever the repeated blocks.
+ *
+ * @param idx the index
+ * @param p1 next byte of the first file expected to be copied
+ * @param weak weak checksum of the window
+ * @param w the window (a whole block)
+ * @return long - the block, -1 if there is none
+ */
+static long lookup(const index_t *idx, off_t p1, uint32_t weak,
+                   const unsigned char *w) {
+    uint32_t full = idx->nb - (idx->tail != 0);
+    uint64_t strong[2];
+    int hashed = 0;
+
+    if (p1 % idx->bsize == 0 && p1 / (off_t)idx->bsize < full) {
+        const struct block_s *blk = &idx->blocks[p1 / idx->bsize];
+        if (blk->weak == weak) {
+            hash_buf(w, idx->bsize, strong);
+            hashed = 1;
+            if (memcmp(strong, blk->strong, sizeof(strong)) == 0)
+                return p1 / idx->bsize;
+        }
+    }
+
+    for (uint32_t k = idx->heads[bucket_of(weak, idx->mask)]; k != NIL;
+         k = idx->blocks[k].next) {
+        const struct block_s *blk = &idx->blocks[k];
+        if (blk->weak != weak)
+            continue;
+        if (!hashed) {
+            hash_buf(w, idx->bsize, strong);
+            hashed = 1;
+        }
+        if (memcmp(strong, blk->strong, sizeof(strong)) == 0)
+            return k;
+    }
+
+    return -1;
+}
+
+/*
+ * output : delta and report
+ */
+
+/**
+ * @brief report the region between the last copy and a copy from src
+ *
+ * @param d the delta
+ * @param src offset in the first file of the copy (its size at the end)
+ */
+static void report(delta_t *d, off_t src) {
+    off_t gap = src > d->p1 ? src - d->p1 : 0;
+
+    if (gap == 0 && d->lit == 0)
+        return;
+    d->differ = 1;
+    if (d->silent)
+        return;
+
+    if (gap != 0 && d->lit != 0)
+        fprintf(stderr, "%s %s differ: bytes %jd-%jd replaced by bytes %jd-%jd\n",
+                d->f1, d->f2, (intmax_t)d->p1 + 1, (intmax_t)(d->p1 + gap),
+                (intmax_t)d->o2 + 1, (intmax_t)(d->o2 + d->lit));
+    else if (gap != 0)
+        fprintf(stderr, "%s %s differ: bytes %jd-%jd deleted before byte %jd\n",
+                d->f1, d->f2, (intmax_t)d->p1 + 1, (intmax_t)(d->p1 + gap),
+                (intmax_t)d->o2 + 1);
+    else
+        fprintf(stderr, "%s %s differ: bytes %jd-%jd inserted before byte %jd\n",
+                d->f1, d->f2, (intmax_t)d->o2 + 1, (intmax_t)(d->o2 + d->lit),
+                (intmax_t)d->p1 + 1);
+}
+
+static void flush_copy(delta_t *d) {
+    if (d->len == 0)
+        return;
+    putc('C', d->out);
+    put_varint(d->out, d->src);
+    put_varint(d->out, d->len);
+    d->len = 0;
+}
+
+static void emit_literal(delta_t *d, const unsigned char *p, size_t n) {
+    if (n == 0)
+        return;
+    flush_copy(d);
+    putc('L', d->out);
+    put_varint(d->out, n);
+    if (fwrite(p, 1, n, d->out) != n)
+        raler(1, "writing the delta");
+    d->lit += n;
+}
+
+static void emit_copy(delta_t *d, off_t src, off_t len) {
+    report(d, src);
+    d->o2 += d->lit + len;
+    d->lit = 0;
+    if (src + len > d->p1)
+        d->p1 = src + len;
+
+    if (d->len != 0 && d->src + d->len == src) {
+        d->len += len;
+        return;
+    }
+    flush_copy(d);
+    d->src = src;
+    d->len = len;
+}
+
+/*
+ * interface
+ */
+
+int compare_delta(const char *filename1, const char *filename2,
+                  const char *deltafile, const options_t *opts) {
+    uint32_t header[2] = {DELTA_MAGIC, 0};
+    unsigned char *buf;
+    size_t cap, filled = 0, pos = 0, lit = 0;
+    int fd1, fd2, eof = 0, summed = 0;
+    uint32_t a = 0, b = 0;
+    off_t size1;
+    index_t idx;
+    delta_t d;
+
+    memset(&d, 0, sizeof(d));
+    d.f1 = filename1;
+    d.f2 = filename2;
+    d.silent = opts->silent;
+    if (strcmp(deltafile, "-") == 0)
+        d.out = stdout;
+    else if ((d.out = fopen(deltafile, "w")) == NULL)
+        raler(1, "%s", deltafile);
+    if (fwrite(header, sizeof(header), 1, d.out) != 1)
+        raler(1, "writing %s", deltafile);
+
+    CHK(fd1 = open(filename1, O_RDONLY));
+    size1 = build_index(&idx, fd1);
+    CHK(close(fd1));
+
+    // the window slides in a buffer of several blocks, refilled when needed
+    size_t bs = idx.bsize;
+    cap = 4 * bs < (1ul << 20) ? 1ul << 20 : 4 * bs;
+    if ((buf = malloc(cap)) == NULL)
+        raler(1, "malloc");
+    CHK(fd2 = open(filename2, O_RDONLY));
+
+    for (;;) {
+        if (pos + bs > filled && !eof) {
+            emit_literal(&d, buf + lit, pos - lit);
+            memmove(buf, buf + pos, filled - pos);
+            filled -= pos;
+            pos = lit = 0;
+            size_t n = read_full(fd2, buf + filled, cap - filled);
+            eof = n < cap - filled;
+            filled += n;
+            summed = 0;
+            continue;
+        }
+        if (pos + bs > filled)
+            break; // less than a block left
+
+        if (!summed) {
+            weak_init(buf + pos, bs, &a, &b);
+            summed = 1;
+        }
+
+        long k = lookup(&idx, d.p1, weak_of(a, b), buf + pos);
+        if (k >= 0) {
+            emit_literal(&d, buf + lit, pos - lit);
+            emit_copy(&d, (off_t)k * bs, bs);
+            pos += bs;
+            lit = pos;
+            summed = 0;
+            continue;
+        }
+
+        // roll the window one byte further
+        if (pos + bs < filled) {
+            uint32_t out = buf[pos], in = buf[pos + bs];
+            a += in - out;
+            b += a - (uint32_t)bs * out;
+        } else {
+            summed = 0;
+        }
+        pos++;
+    }
+
+    // the short last block of the first file can only end the second one
+    if (idx.tail != 0 && filled - pos == idx.tail) {
+        uint64_t strong[2];
+        const struct block_s *blk = &idx.blocks[idx.nb - 1];
+        hash_buf(buf + pos, idx.tail, strong);
+        if (memcmp(strong, blk->strong, sizeof(strong)) == 0) {
+            emit_literal(&d, buf + lit, pos - lit);
+            emit_copy(&d, (off_t)(idx.nb - 1) * bs, idx.tail);
+            lit = pos = filled;
+        }
+    }
+    emit_literal(&d, buf + lit, filled - lit);
+    report(&d, size1);
+    flush_copy(&d);
+    putc('E', d.out);
+    put_varint(d.out, d.o2 + d.lit);
+
+    if (d.out == stdout ? fflush(stdout) == EOF : fclose(d.out) == EOF)
+        raler(1, "writing %s", deltafile);
+    CHK(close(fd2));
+    free(buf);
+    free(idx.blocks);
+    free(idx.heads);
+    return d.differ;
+}
+
+void apply_delta(const char *deltafile, const char *filename1,
+                 const char *filename2) {
+    unsigned char buf[16 * BUFSIZE];
+    uint32_t header[2];
+    uint64_t written = 0, off, len;
+    FILE *in, *out;
+    ssize_t n;
+    int fd1, op;
+
+    if ((in = fopen(deltafile, "r")) == NULL)
+        raler(1, "%s", deltafile);
+    if (fread(header, sizeof(header), 1, in) != 1 || header[0] != DELTA_MAGIC)
+        raler(0, "%s: not a delta", deltafile);
+    CHK(fd1 = open(filename1, O_RDONLY));
+    if ((out = fopen(filename2, "w")) == NULL)
+        raler(1, "%s", filename2);
+
+    while ((op = getc(in)) != 'E') {
+        switch (op) {
+        case 'C':
+            off = get_varint(in, deltafile);
+            len = get_varint(in, deltafile);
+            for (; len > 0; len -= n, off += n) {
+                size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+                CHK(n = pread(fd1, buf, chunk, off));
+                if (n == 0)
+                    raler(0, "%s: %s is too short", deltafile, filename1);
+                if (fwrite(buf, 1, n, out) != (size_t)n)
+                    raler(1, "writing %s", filename2);
+                written += n;
+            }
+            break;
+        case 'L':
+            len = get_varint(in, deltafile);
+            for (; len > 0; len -= n) {
+                size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+                if (fread(buf, 1, chunk, in) != chunk)
+                    raler(0, "%s: truncated delta", deltafile);
+                if (fwrite(buf, 1, chunk, out) != chunk)
+                    raler(1, "writing %s", filename2);
+                n = chunk;
+                written += n;
+            }
+            break;
+        default:
+            raler(0, "%s: truncated delta", deltafile);
+        }
+    }
+
+    if (get_varint(in, deltafile) != written)
+        raler(0, "%s: wrong size of %s", deltafile, filename2);
+    if (fclose(out) == EOF)
+        raler(1, "writing %s", filename2);
+    fclose(in);
+    CHK(close(fd1));
+}
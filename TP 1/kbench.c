@@ -0,0 +1,140 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "kernels.h"
+
+/*
+ * Microbenchmark of the byte kernels used by compare :
+ *      ./kbench            // every kernel, every size, every position
+ *
+ * For each kernel supported by the cpu, reports the throughput of buf_cmp()
+ * (bytes scanned until the difference) and count_nl() (bytes scanned until
+ * the difference too, as compare does) in GB/s.
+ */
+
+#define MIN_BYTES (1ul << 28) // bytes to scan for each measure
+#define MAX_SIZE (1l << 24)   // largest buffer size
+
+noreturn void raler(int syserr, const char *msg, ...) {
+    va_list ap;
+
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+
+    if (syserr == 1)
+        perror("");
+
+    exit(EXIT_FAILURE);
+}
+
+/// where the difference is put in the second buffer
+enum pos_e { POS_START, POS_MIDDLE, POS_END, POS_NONE };
+static const char *pos_names[] = {"start", "middle", "end", "none"};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ssize_t diff_pos(enum pos_e pos, ssize_t size) {
+    switch (pos) {
+    case POS_START:
+        return 0;
+    case POS_MIDDLE:
+        return size / 2;
+    case POS_END:
+        return size - 1;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief measure one kernel on one buffer pair
+ *
+ * @param k kernel to measure
+ * @param b1 buffer 1
+ * @param b2 buffer 2
+ * @param size size of the buffers
+ * @param scanned number of bytes actually read by one call
+ * @param cmp_gbs throughput of buf_cmp in GB/s
+ * @param nl_gbs throughput of count_nl in GB/s
+ */
+static void measure(const kernel_t *k, const unsigned char *b1,
+                    const unsigned char *b2, ssize_t size, ssize_t scanned,
+                    double *cmp_gbs, double *nl_gbs) {
+    volatile ssize_t sink = 0;
+    long reps = (long)(MIN_BYTES / (unsigned long)scanned) + 1;
+    double t;
+
+    t = now();
+    for (long r = 0; r < reps; r++)
+        sink += k->buf_cmp(b1, b2, size);
+    *cmp_gbs = (double)reps * scanned / (now() - t) / 1e9;
+
+    t = now();
+    for (long r = 0; r < reps; r++)
+        sink += k->count_nl(b1, scanned);
+    *nl_gbs = (double)reps * scanned / (now() - t) / 1e9;
+
+    (void)sink;
+}
+
+int main(void) {
+    const ssize_t sizes[] = {64, 512, 4096, 65536, 1l << 20, MAX_SIZE};
+    unsigned char *b1, *b2;
+
+    if ((b1 = malloc(MAX_SIZE)) == NULL || (b2 = malloc(MAX_SIZE)) == NULL)
+        raler(1, "malloc");
+
+    // text-like content : one newline every 64 bytes or so
+    srand(42);
+    for (ssize_t i = 0; i < MAX_SIZE; i++)
+        b1[i] = (rand() % 64 == 0) ? '\n' : (unsigned char)('a' + rand() % 26);
+
+    __builtin_cpu_init();
+    printf("%-7s %9s %-7s %10s %10s\n", "kernel", "size", "diff", "cmp GB/s",
+           "nl GB/s");
+
+    for (int i = 0; i < nb_kernels; i++) {
+        const kernel_t *k = &kernels[i];
+        if (!k->usable())
+            continue;
+
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (int p = POS_START; p <= POS_NONE; p++) {
+                ssize_t size = sizes[s];
+                ssize_t d = diff_pos(p, size);
+                double cmp_gbs, nl_gbs;
+
+                memcpy(b2, b1, size);
+                if (d >= 0)
+                    b2[d] ^= 0xff;
+
+                // check the kernel against the reference before timing it
+                if (k->buf_cmp(b1, b2, size) != d ||
+                    k->count_nl(b1, size) != kernels[0].count_nl(b1, size))
+                    raler(0, "kernel %s is wrong for size %zd", k->name,
+                          size);
+
+                measure(k, b1, b2, size, d >= 0 ? d + 1 : size, &cmp_gbs,
+                        &nl_gbs);
+                printf("%-7s %9zd %-7s %10.2f %10.2f\n", k->name, size,
+                       pos_names[p], cmp_gbs, nl_gbs);
+            }
+        }
+    }
+
+    free(b1);
+    free(b2);
+    return 0;
+}
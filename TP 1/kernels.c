@@ -0,0 +1,245 @@
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+// byte counters overflow after 255 increments, so they are flushed before
+#define NL_FLUSH 255
+
+/*
+ * scalar kernels (always available, also used for the tails of the vector
+ * kernels) ; they are kept out of the auto-vectorizer so that the fallback
+ * really is the byte-per-byte loop
+ */
+
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+
+static int scalar_usable(void) { return 1; }
+
+SCALAR static ssize_t scalar_buf_cmp(const unsigned char *buf1,
+                                     const unsigned char *buf2,
+                                     ssize_t size) {
+    for (ssize_t i = 0; i < size; i++)
+        if (buf1[i] != buf2[i])
+            return i;
+
+    return -1;
+}
+
+SCALAR static ssize_t scalar_count_nl(const unsigned char *buf, ssize_t size) {
+    ssize_t nl = 0;
+
+    for (ssize_t i = 0; i < size; i++)
+        if (buf[i] == '\n')
+            nl++;
+
+    return nl;
+}
+
+/*
+ * sse2 kernels (16 bytes at a time)
+ */
+
+static int sse2_usable(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2"))) static ssize_t
+sse2_buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
+             ssize_t size) {
+    ssize_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(buf1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf2 + i));
+        unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (eq != 0xffffu)
+            return i + __builtin_ctz(~eq);
+    }
+
+    ssize_t r = scalar_buf_cmp(buf1 + i, buf2 + i, size - i);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("sse2"))) static ssize_t
+sse2_count_nl(const unsigned char *buf, ssize_t size) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    __m128i total = _mm_setzero_si128();
+    ssize_t i = 0;
+
+    while (i + 16 <= size) {
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < NL_FLUSH && i + 16 <= size; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, _mm_setzero_si128()));
+    }
+
+    return _mm_cvtsi128_si64(total) +
+           _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total)) +
+           scalar_count_nl(buf + i, size - i);
+}
+
+/*
+ * avx2 kernels (64 bytes per iteration, 32 bytes per vector)
+ */
+
+static int avx2_usable(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2"))) static ssize_t
+avx2_buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
+             ssize_t size) {
+    ssize_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(buf1 + i));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(buf2 + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(buf1 + i + 32));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(buf2 + i + 32));
+        __m256i e0 = _mm256_cmpeq_epi8(a0, b0);
+        __m256i e1 = _mm256_cmpeq_epi8(a1, b1);
+        if ((unsigned)_mm256_movemask_epi8(_mm256_and_si256(e0, e1)) ==
+            0xffffffffu)
+            continue;
+
+        unsigned m0 = (unsigned)_mm256_movemask_epi8(e0);
+        if (m0 != 0xffffffffu)
+            return i + __builtin_ctz(~m0);
+        return i + 32 + __builtin_ctz(~(unsigned)_mm256_movemask_epi8(e1));
+    }
+
+    ssize_t r = sse2_buf_cmp(buf1 + i, buf2 + i, size - i);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2"))) static ssize_t
+avx2_count_nl(const unsigned char *buf, ssize_t size) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i total = _mm256_setzero_si256();
+    ssize_t i = 0;
+
+    while (i + 32 <= size) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int k = 0; k < NL_FLUSH && i + 32 <= size; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        total = _mm256_add_epi64(total,
+                                 _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+    }
+
+    return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+           _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3) +
+           scalar_count_nl(buf + i, size - i);
+}
+
+/*
+ * avx-512 kernels (64 bytes at a time, comparisons straight into masks)
+ */
+
+static int avx512_usable(void) {
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("avx512f,avx512bw"))) static ssize_t
+avx512_buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
+               ssize_t size) {
+    ssize_t i = 0;
+
+    for (; i + 128 <= size; i += 128) {
+        __m512i a0 = _mm512_loadu_si512((const void *)(buf1 + i));
+        __m512i b0 = _mm512_loadu_si512((const void *)(buf2 + i));
+        __m512i a1 = _mm512_loadu_si512((const void *)(buf1 + i + 64));
+        __m512i b1 = _mm512_loadu_si512((const void *)(buf2 + i + 64));
+        __mmask64 ne0 = _mm512_cmpneq_epi8_mask(a0, b0);
+        __mmask64 ne1 = _mm512_cmpneq_epi8_mask(a1, b1);
+        if ((ne0 | ne1) == 0)
+            continue;
+
+        if (ne0 != 0)
+            return i + __builtin_ctzll(ne0);
+        return i + 64 + __builtin_ctzll(ne1);
+    }
+
+    for (; i + 64 <= size; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void *)(buf1 + i));
+        __m512i b = _mm512_loadu_si512((const void *)(buf2 + i));
+        __mmask64 ne = _mm512_cmpneq_epi8_mask(a, b);
+        if (ne != 0)
+            return i + __builtin_ctzll(ne);
+    }
+
+    // masked loads never touch the bytes past the end of the buffers
+    if (i < size) {
+        __mmask64 tail = (1ull << (size - i)) - 1;
+        __m512i a = _mm512_maskz_loadu_epi8(tail, buf1 + i);
+        __m512i b = _mm512_maskz_loadu_epi8(tail, buf2 + i);
+        __mmask64 ne = _mm512_cmpneq_epi8_mask(a, b);
+        if (ne != 0)
+            return i + __builtin_ctzll(ne);
+    }
+
+    return -1;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt"))) static ssize_t
+avx512_count_nl(const unsigned char *buf, ssize_t size) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    ssize_t count = 0;
+    ssize_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(buf + i));
+        count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(v, nl));
+    }
+
+    if (i < size) {
+        __mmask64 tail = (1ull << (size - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(tail, buf + i);
+        count += __builtin_popcountll(_mm512_mask_cmpeq_epi8_mask(tail, v, nl));
+    }
+
+    return count;
+}
+
+const kernel_t kernels[] = {
+    {"scalar", scalar_usable, scalar_buf_cmp, scalar_count_nl},
+    {"sse2", sse2_usable, sse2_buf_cmp, sse2_count_nl},
+    {"avx2", avx2_usable, avx2_buf_cmp, avx2_count_nl},
+    {"avx512", avx512_usable, avx512_buf_cmp, avx512_count_nl},
+};
+const int nb_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+// kernel in use, scalar until kernels_init() has been called
+static const kernel_t *active = &kernels[0];
+
+const kernel_t *kernels_init(void) {
+    const char *forced = getenv("COMPARE_KERNEL");
+
+    __builtin_cpu_init();
+    for (int i = nb_kernels - 1; i >= 0; i--) {
+        if (!kernels[i].usable())
+            continue;
+        if (forced != NULL && strcmp(forced, kernels[i].name) != 0)
+            continue;
+        active = &kernels[i];
+        break;
+    }
+
+    return active;
+}
+
+ssize_t buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
+                ssize_t size) {
+    return active->buf_cmp(buf1, buf2, size);
+}
+
+ssize_t count_nl(const unsigned char *buf, ssize_t size) {
+    return active->count_nl(buf, size);
+}
@@ -0,0 +1,49 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <sys/types.h>
+
+/// a set of byte kernels for a given instruction set
+struct kernel_s {
+    const char *name;   // name of the instruction set
+    int (*usable)(void); // 1 if the cpu can run this kernel
+    ssize_t (*buf_cmp)(const unsigned char *, const unsigned char *, ssize_t);
+    ssize_t (*count_nl)(const unsigned char *, ssize_t);
+};
+typedef struct kernel_s kernel_t;
+
+// every kernel known to this build, from the slowest to the fastest
+extern const kernel_t kernels[];
+extern const int nb_kernels;
+
+/**
+ * @brief select the fastest kernel supported by the cpu
+ *
+ * @note the COMPARE_KERNEL environment variable may be set to the name of a
+ * kernel to force its use (mostly useful for testing the fallbacks)
+ * @return const kernel_t* - the selected kernel
+ */
+const kernel_t *kernels_init(void);
+
+/**
+ * @brief compare two buffers
+ *
+ * @param buf1 buffer 1
+ * @param buf2 buffer 2
+ * @param size size of the shortest buffer
+ * @return ssize_t - position of the byte that differs or -1 if buffers are
+ * equals
+ */
+ssize_t buf_cmp(const unsigned char *buf1, const unsigned char *buf2,
+                ssize_t size);
+
+/**
+ * @brief count number of newlines in buffer
+ *
+ * @param buf buffer
+ * @param size size of buffer
+ * @return ssize_t - number of newlines
+ */
+ssize_t count_nl(const unsigned char *buf, ssize_t size);
+
+#endif
@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compare.h"
+#include "kernels.h"
+
+/*
+ * Comparison of one reference file against several candidates.
+ *
+ * The reference is read once, block by block, and every candidate still
+ * identical so far reads the same block in lockstep and is compared against
+ * it. A candidate which differs or ends is settled and leaves the loop, the
+ * reference is not read any further once they all have.
+ *
+ * The candidates share the position and the line number of the reference,
+ * as they are identical to it up to the current block.
+ */
+
+#define MBLOCK (256ul << 10) // size of a block
+
+/// a candidate file
+struct cand_s {
+    int fd;
+    int active; // still identical to the reference
+    result_t res;
+};
+
+/**
+ * @brief compare one block of a candidate against the reference
+ *
+ * @param c the candidate
+ * @param ref block of the reference
+ * @param nref size of the reference block (< MBLOCK at its end only)
+ * @param buf buffer for the candidate block
+ * @param bytes_read bytes before this block
+ * @param line_number line at the start of this block
+ */
+static void compare_block(struct cand_s *c, const unsigned char *ref,
+                          ssize_t nref, unsigned char *buf, off_t bytes_read,
+                          off_t line_number) {
+    ssize_t n = read_full(c->fd, buf, MBLOCK);
+    ssize_t shorter = nref < n ? nref : n;
+    ssize_t cmp;
+
+    if (bytes_read == 0 && nref * n == 0 && nref != n) {
+        c->res.verdict = EOF_EMPTY;
+        c->res.which = nref == 0 ? 0 : 1;
+    } else if ((cmp = buf_cmp(ref, buf, shorter)) >= 0) {
+        c->res.verdict = DIFFER;
+        c->res.byte = bytes_read + cmp + 1;
+        c->res.line = line_number + count_nl(ref, cmp);
+    } else if (nref != n) {
+        c->res.verdict = EOF_AFTER;
+        c->res.which = nref < n ? 0 : 1;
+        c->res.byte = bytes_read + shorter;
+        c->res.line = line_number + count_nl(ref, shorter);
+    } else if (n == 0) {
+        c->res.verdict = SAME;
+    } else {
+        return; // identical so far
+    }
+
+    c->active = 0;
+}
+
+/**
+ * @brief compare a reference file against several others
+ *
+ * @param ref name of the reference file
+ * @param names names of the candidate files
+ * @param nb number of candidates
+ * @param opts how to compare (only silent is used)
+ * @return int - 0 if every candidate is identical to the reference, 1
+ * otherwise
+ */
+int compare_multi(const char *ref, char *const names[], int nb,
+                  const options_t *opts) {
+    struct cand_s *cands = malloc(nb * sizeof(struct cand_s));
+    unsigned char *rbuf = malloc(MBLOCK), *cbuf = malloc(MBLOCK);
+    off_t bytes_read = 0, line_number = 1;
+    int fd, active = nb, result = 0;
+
+    if (cands == NULL || rbuf == NULL || cbuf == NULL)
+        raler(1, "malloc");
+
+    CHK(fd = open(ref, O_RDONLY));
+    for (int i = 0; i < nb; i++) {
+        CHK(cands[i].fd = open(names[i], O_RDONLY));
+        cands[i].active = 1;
+    }
+
+    while (active > 0) {
+        ssize_t nref = read_full(fd, rbuf, MBLOCK);
+
+        for (int i = 0; i < nb; i++) {
+            if (!cands[i].active)
+                continue;
+            compare_block(&cands[i], rbuf, nref, cbuf, bytes_read,
+                          line_number);
+            if (!cands[i].active)
+                active--;
+        }
+
+        bytes_read += nref;
+        line_number += count_nl(rbuf, nref);
+    }
+
+    for (int i = 0; i < nb; i++) {
+        if (!opts->silent)
+            print_result(stderr, &cands[i].res, ref, names[i]);
+        result |= cands[i].res.verdict != SAME;
+        CHK(close(cands[i].fd));
+    }
+
+    CHK(close(fd));
+    free(cands);
+    free(rbuf);
+    free(cbuf);
+    return result;
+}
@@ -0,0 +1,186 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compare.h"
+#include "kernels.h"
+
+/*
+ * Parallel comparison of two regular files.
+ *
+ * The common prefix of both files is cut into CHUNK-sized ranges that the
+ * threads take in increasing order. Each range is mapped and compared slice
+ * by slice, counting its newlines as it goes. The first difference found so
+ * far is shared, so that the ranges (and slices) past it are abandoned.
+ *
+ * Every range before the one holding the first difference is complete, and
+ * the line number is 1 + the prefix sum of their newline counts plus the
+ * newlines of the last range up to the difference.
+ */
+
+#define CHUNK (16l << 20) // size of a range (multiple of a page)
+#define SLICE (1l << 20)  // granularity of the cancellation in a range
+#define MAXJOBS 1024
+
+/// shared state of the threads
+struct job_s {
+    int fd1, fd2;
+    off_t size;              // size of the common prefix
+    long nb_chunks;          // number of ranges
+    ssize_t *nl;             // newlines of each range (until its difference)
+    atomic_long next;        // next range to compare
+    _Atomic off_t first_diff; // first differing byte so far (size if none)
+};
+typedef struct job_s job_t;
+
+/**
+ * @brief lower the shared first difference to off if it is lower
+ *
+ * @param job the shared state
+ * @param off offset of a differing byte
+ */
+static void lower_first_diff(job_t *job, off_t off) {
+    off_t cur = atomic_load(&job->first_diff);
+
+    while (off < cur &&
+           !atomic_compare_exchange_weak(&job->first_diff, &cur, off))
+        ;
+}
+
+/**
+ * @brief compare one range of both files
+ *
+ * @param job the shared state
+ * @param c index of the range
+ */
+static void compare_chunk(job_t *job, long c) {
+    off_t start = c * CHUNK;
+    size_t len = job->size - start < CHUNK ? job->size - start : CHUNK;
+    const unsigned char *w1 = map_window(job->fd1, start, len);
+    const unsigned char *w2 = w1 ? map_window(job->fd2, start, len) : NULL;
+    ssize_t nl = 0;
+
+    if (w2 == NULL)
+        raler(1, "mmap at offset %jd", (intmax_t)start);
+
+    for (size_t s = 0; s < len; s += SLICE) {
+        // a difference was found before this slice, the rest is useless
+        if (start + (off_t)s >= atomic_load(&job->first_diff))
+            break;
+
+        ssize_t slen = len - s < SLICE ? (ssize_t)(len - s) : SLICE;
+        ssize_t cmp = buf_cmp(w1 + s, w2 + s, slen);
+        nl += count_nl(w1 + s, cmp >= 0 ? cmp : slen);
+        if (cmp >= 0) {
+            lower_first_diff(job, start + s + cmp);
+            break;
+        }
+    }
+
+    job->nl[c] = nl;
+    CHK(munmap((void *)w1, len));
+    CHK(munmap((void *)w2, len));
+}
+
+/**
+ * @brief thread main loop : take the next range until there is none left or
+ * until they are all past the first difference
+ *
+ * @param arg the shared state
+ * @return void* - NULL
+ */
+static void *worker(void *arg) {
+    job_t *job = arg;
+    long c;
+
+    while ((c = atomic_fetch_add(&job->next, 1)) < job->nb_chunks) {
+        if (c * CHUNK >= atomic_load(&job->first_diff))
+            break;
+        compare_chunk(job, c);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief compare two regular files with several threads
+ *
+ * @param fd1 file descriptor of the first file
+ * @param fd2 file descriptor of the second file
+ * @param jobs number of threads
+ * @param res outcome of the comparison
+ * @return int - 0 if the files are identical, 1 otherwise, -1 if they are not
+ * both non-empty regular files that can be mapped (res is left untouched)
+ */
+int compare_parallel(int fd1, int fd2, int jobs, result_t *res) {
+    struct stat st1, st2;
+    pthread_t tids[MAXJOBS];
+    job_t job;
+    int r;
+
+    CHK(fstat(fd1, &st1));
+    CHK(fstat(fd2, &st2));
+    if (!S_ISREG(st1.st_mode) || !S_ISREG(st2.st_mode) || st1.st_size == 0 ||
+        st2.st_size == 0)
+        return -1;
+
+    // check once that both files can be mapped before starting the threads
+    const unsigned char *p1 = map_window(fd1, 0, 1);
+    const unsigned char *p2 = map_window(fd2, 0, 1);
+    if (p1 != NULL)
+        CHK(munmap((void *)p1, 1));
+    if (p2 != NULL)
+        CHK(munmap((void *)p2, 1));
+    if (p1 == NULL || p2 == NULL)
+        return -1;
+
+    job.fd1 = fd1;
+    job.fd2 = fd2;
+    job.size = st1.st_size < st2.st_size ? st1.st_size : st2.st_size;
+    job.nb_chunks = (job.size + CHUNK - 1) / CHUNK;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.first_diff, job.size);
+    if ((job.nl = calloc(job.nb_chunks, sizeof(ssize_t))) == NULL)
+        raler(1, "calloc");
+
+    if (jobs > job.nb_chunks)
+        jobs = job.nb_chunks;
+    if (jobs > MAXJOBS)
+        jobs = MAXJOBS;
+
+    for (int i = 0; i < jobs; i++)
+        if ((r = pthread_create(&tids[i], NULL, worker, &job)) != 0)
+            raler(0, "pthread_create: %s", strerror(r));
+    for (int i = 0; i < jobs; i++)
+        if ((r = pthread_join(tids[i], NULL)) != 0)
+            raler(0, "pthread_join: %s", strerror(r));
+
+    // reduction : prefix sum of the newlines up to the first difference
+    off_t diff = atomic_load(&job.first_diff);
+    long last = diff < job.size ? diff / CHUNK : job.nb_chunks - 1;
+    ssize_t line_number = 1;
+    for (long c = 0; c <= last; c++)
+        line_number += job.nl[c];
+    free(job.nl);
+
+    res->line = line_number;
+    if (diff < job.size) {
+        res->verdict = DIFFER;
+        res->byte = diff + 1;
+    } else if (st1.st_size != st2.st_size) {
+        res->verdict = EOF_AFTER;
+        res->which = st1.st_size < st2.st_size ? 0 : 1;
+        res->byte = job.size;
+    } else {
+        res->verdict = SAME;
+    }
+
+    return res->verdict != SAME;
+}
@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compare.h"
+
+/*
+ * Asynchronous reader of two files, block pair by block pair.
+ *
+ * Up to PF_DEPTH blocks of each file are read ahead while the caller compares
+ * the current pair. Reads go through io_uring when the kernel allows it,
+ * through one reading thread per file otherwise (or when COMPARE_PREFETCH is
+ * set to "thread").
+ *
+ * A block is always full, except the last one of a file : like read_full(),
+ * short reads are completed before the block is handed over. Seekable files
+ * have all their blocks in flight at once, at explicit offsets ; the others
+ * (pipes, ttys) only one at a time, since their reads must stay in order.
+ */
+
+#define PF_BLOCK (128l << 10) // size of a block
+#define PF_DEPTH 8            // blocks read ahead for each file
+#define PF_CANCEL UINT64_MAX
+
+enum slot_state_e { SLOT_FREE, SLOT_INFLIGHT, SLOT_READY };
+
+/// a buffer holding one block of a file
+struct slot_s {
+    unsigned char *buf;
+    ssize_t filled;         // number of bytes in the buffer
+    off_t seq;              // index of the block in the file
+    enum slot_state_e state;
+};
+
+/// read ahead state of one file
+struct stream_s {
+    int fd;
+    int seekable;  // blocks can be read at explicit offsets
+    off_t base;    // offset of the first block
+    off_t issued;  // next block to read
+    off_t consumed; // next block to hand over
+    off_t eof_seq; // first block which holds the end of file (or -1)
+    int inflight;  // number of reads in flight
+    int held;      // the caller holds the block consumed - 1
+    struct slot_s slots[PF_DEPTH];
+
+    // thread backend only
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/// io_uring rings, mapped from the kernel
+struct uring_s {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned to_submit; // queued but not yet submitted entries
+};
+
+struct prefetch_s {
+    int uring;   // 1 for io_uring, 0 for threads
+    int closing; // reads are being cancelled, nothing is issued anymore
+    struct uring_s ring;
+    struct stream_s s[2];
+};
+
+/*
+ * io_uring backend
+ */
+
+static int uring_setup(struct uring_s *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = 0;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = r->cq_len == 0 || r->sq_ptr == MAP_FAILED
+                    ? r->sq_ptr
+                    : mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, r->fd,
+                           IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED ||
+        r->sqes == MAP_FAILED)
+        raler(1, "mmap io_uring");
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->to_submit = 0;
+    return 0;
+}
+
+static void uring_teardown(struct uring_s *r) {
+    CHK(munmap(r->sqes, r->sqes_len));
+    if (r->cq_len != 0)
+        CHK(munmap(r->cq_ptr, r->cq_len));
+    CHK(munmap(r->sq_ptr, r->sq_len));
+    CHK(close(r->fd));
+}
+
+/**
+ * @brief get a free submission entry (the ring is sized so there is always
+ * one, every read in flight holding at most one entry)
+ *
+ * @param r the rings
+ * @return struct io_uring_sqe* - the zeroed entry
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring_s *r) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief submit the queued entries and wait for at least one completion
+ *
+ * @param r the rings
+ */
+static void uring_wait(struct uring_s *r) {
+    while (syscall(__NR_io_uring_enter, r->fd, r->to_submit, 1,
+                   IORING_ENTER_GETEVENTS, NULL, 0) == -1)
+        if (errno != EINTR)
+            raler(1, "io_uring_enter");
+    r->to_submit = 0;
+}
+
+static void uring_issue(struct prefetch_s *pf, int i, int k) {
+    struct stream_s *s = &pf->s[i];
+    struct slot_s *slot = &s->slots[k];
+    struct io_uring_sqe *sqe = uring_get_sqe(&pf->ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)(slot->buf + slot->filled);
+    sqe->len = PF_BLOCK - slot->filled;
+    sqe->off = s->seekable ? (uint64_t)(s->base + slot->seq * PF_BLOCK +
+                                        slot->filled)
+                           : (uint64_t)-1;
+    sqe->user_data = (uint64_t)(i * PF_DEPTH + k);
+    s->inflight++;
+}
+
+/**
+ * @brief handle every available completion
+ *
+ * @param pf the reader
+ */
+static void uring_reap(struct prefetch_s *pf) {
+    struct uring_s *r = &pf->ring;
+    unsigned head = *r->cq_head;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+
+        if (data == PF_CANCEL)
+            continue;
+
+        struct stream_s *s = &pf->s[data / PF_DEPTH];
+        struct slot_s *slot = &s->slots[data % PF_DEPTH];
+        s->inflight--;
+
+        if (pf->closing) {
+            slot->state = SLOT_FREE;
+        } else if (res == -EINTR || res == -EAGAIN) {
+            uring_issue(pf, data / PF_DEPTH, data % PF_DEPTH);
+        } else if (res == -ECANCELED) {
+            slot->state = SLOT_FREE;
+        } else if (res < 0) {
+            errno = -res;
+            raler(1, "asynchronous read");
+        } else if (res > 0 && (slot->filled += res) < PF_BLOCK) {
+            uring_issue(pf, data / PF_DEPTH, data % PF_DEPTH); // short read
+        } else {
+            if (res == 0 && (s->eof_seq < 0 || slot->seq < s->eof_seq))
+                s->eof_seq = slot->seq;
+            slot->state = SLOT_READY;
+        }
+    }
+}
+
+/**
+ * @brief start reading the blocks that fit in the free slots
+ *
+ * @param pf the reader
+ * @param i index of the file
+ */
+static void uring_refill(struct prefetch_s *pf, int i) {
+    struct stream_s *s = &pf->s[i];
+
+    while (s->issued < s->consumed - s->held + PF_DEPTH &&
+           (s->eof_seq < 0 || s->issued <= s->eof_seq) &&
+           (s->seekable || s->inflight == 0)) {
+        struct slot_s *slot = &s->slots[s->issued % PF_DEPTH];
+        slot->seq = s->issued++;
+        slot->filled = 0;
+        slot->state = SLOT_INFLIGHT;
+        uring_issue(pf, i, slot->seq % PF_DEPTH);
+    }
+}
+
+/*
+ * thread backend
+ */
+
+static void unlock_cleanup(void *arg) { pthread_mutex_unlock(arg); }
+
+/**
+ * @brief wait until the next block has a free slot
+ *
+ * @note the thread may be cancelled while waiting, the lock is then released
+ * @param s the stream being read
+ */
+static void wait_free_slot(struct stream_s *s) {
+    pthread_mutex_lock(&s->lock);
+    pthread_cleanup_push(unlock_cleanup, &s->lock);
+    while (s->issued >= s->consumed - s->held + PF_DEPTH)
+        pthread_cond_wait(&s->cond, &s->lock);
+    pthread_cleanup_pop(1);
+}
+
+/**
+ * @brief reading thread : fill the slots in sequence until the end of file
+ *
+ * @param arg the stream to read
+ * @return void* - NULL
+ */
+static void *reader_thread(void *arg) {
+    struct stream_s *s = arg;
+    int eof = 0;
+
+    while (!eof) {
+        wait_free_slot(s);
+
+        struct slot_s *slot = &s->slots[s->issued % PF_DEPTH];
+        slot->filled = read_full(s->fd, slot->buf, PF_BLOCK);
+
+        pthread_mutex_lock(&s->lock);
+        slot->seq = s->issued++;
+        slot->state = SLOT_READY;
+        if (slot->filled < PF_BLOCK) {
+            s->eof_seq = slot->seq;
+            eof = 1;
+        }
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * common interface
+ */
+
+prefetch_t *prefetch_open(int fd1, int fd2) {
+    prefetch_t *pf = calloc(1, sizeof(*pf));
+    const char *forced = getenv("COMPARE_PREFETCH");
+    int r;
+
+    if (pf == NULL)
+        raler(1, "calloc");
+
+    for (int i = 0; i < 2; i++) {
+        struct stream_s *s = &pf->s[i];
+        s->fd = i == 0 ? fd1 : fd2;
+        s->base = lseek(s->fd, 0, SEEK_CUR);
+        s->seekable = s->base != -1;
+        s->eof_seq = -1;
+        for (int k = 0; k < PF_DEPTH; k++)
+            if ((s->slots[k].buf = malloc(PF_BLOCK)) == NULL)
+                raler(1, "malloc");
+    }
+
+    pf->uring = !(forced != NULL && strcmp(forced, "thread") == 0) &&
+                uring_setup(&pf->ring, 4 * PF_DEPTH) == 0;
+    if (pf->uring) {
+        uring_refill(pf, 0);
+        uring_refill(pf, 1);
+        return pf;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        struct stream_s *s = &pf->s[i];
+        if ((r = pthread_mutex_init(&s->lock, NULL)) != 0 ||
+            (r = pthread_cond_init(&s->cond, NULL)) != 0 ||
+            (r = pthread_create(&s->tid, NULL, reader_thread, s)) != 0)
+            raler(0, "prefetch thread: %s", strerror(r));
+    }
+    return pf;
+}
+
+/**
+ * @brief hand over the next block of one file
+ *
+ * @param pf the reader
+ * @param i index of the file
+ * @param buf the block
+ * @return ssize_t - size of the block (< PF_BLOCK only at the end of file)
+ */
+static ssize_t next_block(prefetch_t *pf, int i, const unsigned char **buf) {
+    struct stream_s *s = &pf->s[i];
+    struct slot_s *slot = &s->slots[s->consumed % PF_DEPTH];
+
+    if (!pf->uring)
+        pthread_mutex_lock(&s->lock);
+
+    // give back the previous block, then wait for this one
+    if (s->held) {
+        s->slots[(s->consumed - 1) % PF_DEPTH].state = SLOT_FREE;
+        s->held = 0;
+        if (!pf->uring)
+            pthread_cond_broadcast(&s->cond);
+    }
+
+    if (pf->uring) {
+        uring_refill(pf, i);
+        while (!(s->eof_seq >= 0 && s->consumed > s->eof_seq) &&
+               slot->state != SLOT_READY) {
+            uring_wait(&pf->ring);
+            uring_reap(pf);
+            uring_refill(pf, 0);
+            uring_refill(pf, 1);
+        }
+    } else {
+        while (!(s->eof_seq >= 0 && s->consumed > s->eof_seq) &&
+               !(slot->state == SLOT_READY && s->consumed < s->issued))
+            pthread_cond_wait(&s->cond, &s->lock);
+    }
+
+    ssize_t n = 0;
+    if (!(s->eof_seq >= 0 && s->consumed > s->eof_seq)) {
+        *buf = slot->buf;
+        n = slot->filled;
+        s->held = 1;
+        s->consumed++;
+    }
+
+    if (!pf->uring)
+        pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+void prefetch_next(prefetch_t *pf, const unsigned char *buf[2],
+                   ssize_t n[2]) {
+    n[0] = next_block(pf, 0, &buf[0]);
+    n[1] = next_block(pf, 1, &buf[1]);
+}
+
+void prefetch_close(prefetch_t *pf) {
+    if (pf->uring) {
+        // cancel the reads still in flight and wait until they are over,
+        // the kernel must not write in the buffers once they are freed
+        pf->closing = 1;
+        for (int i = 0; i < 2; i++) {
+            for (int k = 0; k < PF_DEPTH; k++) {
+                if (pf->s[i].slots[k].state != SLOT_INFLIGHT)
+                    continue;
+                struct io_uring_sqe *sqe = uring_get_sqe(&pf->ring);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = (uint64_t)(i * PF_DEPTH + k);
+                sqe->user_data = PF_CANCEL;
+            }
+        }
+        while (pf->s[0].inflight + pf->s[1].inflight > 0) {
+            uring_wait(&pf->ring);
+            uring_reap(pf);
+        }
+        uring_teardown(&pf->ring);
+    } else {
+        for (int i = 0; i < 2; i++) {
+            pthread_cancel(pf->s[i].tid);
+            pthread_join(pf->s[i].tid, NULL);
+            pthread_mutex_destroy(&pf->s[i].lock);
+            pthread_cond_destroy(&pf->s[i].cond);
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+        for (int k = 0; k < PF_DEPTH; k++)
+            free(pf->s[i].slots[k].buf);
+    free(pf);
+}
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Measures a command for the benchmarks (bench.sh) :
+ *      ./runstat cmd [arg...]      // "ms minflt majflt status"
+ *      ./runstat -s cmd [arg...]   // number of system calls
+ *
+ * The first form runs the command as is and prints its elapsed time and
+ * the page faults of the command and its waited children (wait4). The
+ * second one traces the command, its threads and its children with ptrace,
+ * which slows it down a lot : the time is not meaningful then, so both
+ * measures are done by different runs.
+ *
+ * The output of the command goes to /dev/null.
+ */
+
+#define USAGE "Usage: %s [-s] cmd [arg...]"
+
+#define CHK(op)                                                              \
+    do {                                                                     \
+        if ((op) == -1)                                                      \
+            raler(1, #op);                                                   \
+    } while (0)
+
+noreturn void raler(int syserr, const char *msg, ...) {
+    va_list ap;
+
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+
+    if (syserr == 1)
+        perror("");
+
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief run the command in a child process
+ *
+ * @param argv the command and its arguments
+ * @param traced 1 to be traced by the parent
+ * @return pid_t - the pid of the child
+ */
+static pid_t launch(char *argv[], int traced) {
+    pid_t pid;
+    int fd;
+
+    switch (pid = fork()) {
+    case -1:
+        raler(1, "fork");
+    case 0:
+        CHK(fd = open("/dev/null", O_WRONLY));
+        CHK(dup2(fd, STDOUT_FILENO));
+        CHK(dup2(fd, STDERR_FILENO));
+        CHK(close(fd));
+        if (traced)
+            CHK(ptrace(PTRACE_TRACEME, 0, NULL, NULL));
+        execvp(argv[0], argv);
+        raler(1, "%s", argv[0]);
+    }
+
+    return pid;
+}
+
+/**
+ * @brief count the system calls of a traced command until it exits
+ *
+ * @param pid the command, stopped at its exec
+ * @param status exit status of the command
+ * @return long - the number of system calls (entries only)
+ */
+static long count_syscalls(pid_t pid, int *status) {
+    long stops = 0;
+    int st;
+    pid_t p;
+
+    CHK(waitpid(pid, &st, 0)); // SIGTRAP of the exec
+    CHK(ptrace(PTRACE_SETOPTIONS, pid, NULL,
+               PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+                   PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+                   PTRACE_O_EXITKILL));
+    CHK(ptrace(PTRACE_SYSCALL, pid, NULL, 0));
+
+    // every task of the command stops at the entry and exit of its calls
+    while ((p = waitpid(-1, &st, __WALL)) != -1) {
+        int sig = 0;
+
+        if (WIFEXITED(st) || WIFSIGNALED(st)) {
+            if (p == pid)
+                *status = st;
+            continue;
+        }
+        if (!WIFSTOPPED(st))
+            continue;
+        if (WSTOPSIG(st) == (SIGTRAP | 0x80))
+            stops++;
+        else if (WSTOPSIG(st) != SIGTRAP && WSTOPSIG(st) != SIGSTOP)
+            sig = WSTOPSIG(st); // a real signal, delivered
+        // a task may be gone in the meantime (killed with its thread group)
+        if (ptrace(PTRACE_SYSCALL, p, NULL, sig) == -1 && errno != ESRCH)
+            raler(1, "ptrace");
+    }
+    if (errno != ECHILD)
+        raler(1, "waitpid");
+
+    // exit and exit_group don't return
+    return (stops + 1) / 2;
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    struct rusage ru;
+    int traced = 0;
+    int status = 0;
+    pid_t pid;
+
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        traced = 1;
+        argv++;
+        argc--;
+    }
+    if (argc < 2)
+        raler(0, USAGE, argv[0]);
+
+    if (traced) {
+        long n = count_syscalls(launch(argv + 1, 1), &status);
+        printf("%ld\n", n);
+    } else {
+        CHK(clock_gettime(CLOCK_MONOTONIC, &start));
+        pid = launch(argv + 1, 0);
+        CHK(wait4(pid, &status, 0, &ru));
+        CHK(clock_gettime(CLOCK_MONOTONIC, &end));
+        printf("%.3f %ld %ld %d\n",
+               (end.tv_sec - start.tv_sec) * 1e3 +
+                   (end.tv_nsec - start.tv_nsec) / 1e6,
+               ru.ru_minflt, ru.ru_majflt,
+               WIFEXITED(status) ? WEXITSTATUS(status) : 128);
+    }
+
+    return 0;
+}
@@ -90,8 +90,8 @@ test_1()
     if check_echec $?;                             then return 1; fi
     echo "OK"
 
-    echo -n "Test 1.3 - trop d'arguments......................."
-    $PROG test.sh test.sh test.sh  > $TMP/stdout 2> $TMP/stderr
+    echo -n "Test 1.3 - trop d'arguments avec -r..............."
+    $PROG -r . . .                 > $TMP/stdout 2> $TMP/stderr
     if check_echec $?;                             then return 1; fi
     echo "OK"
 
@@ -182,11 +182,175 @@ test_3 ()
     if check_echec $?;                                                  then return 1; fi
     if cmp_sortie  "EOF on $TMP/tata which is empty";                   then return 1; fi
     echo "OK"
+
+    echo -n "Test 3.5 - fichier et tube avec diff.............."
+    LC_ALL=C sed "s/%N/%X/" /bin/ls | $PROG /bin/ls /dev/stdin > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp /bin/ls $TMP/toto > $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f5`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    if cmp_sortie  "/bin/ls /dev/stdin differ: byte $B, line $L";      then return 1; fi
+    echo "OK"
+
+    echo -n "Test 3.6 - tube avec début identique.............."
+    cp /bin/ls $TMP/toto ; echo -n "a" >> $TMP/toto
+    cat /bin/ls | $PROG /dev/stdin $TMP/toto > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp /bin/ls $TMP/toto 2> $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f10`
+    if cmp_sortie "EOF on /dev/stdin after byte $B, line $L";      then return 1; fi
+    echo "OK"
 }
 
 test_4()
 {
-    echo -n "Test 4 - test mémoire............................."
+    echo "Test 4 - options -j, -i, -r, -c et -s"
+
+    echo -n "Test 4.1 - nombre de threads invalide............."
+    $PROG -j 0 /bin/ls /bin/ls     > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.2 - grands fichiers identiques............."
+    $PROG -j 4 /bin/ls /bin/ls     > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.3 - grands fichiers avec diff.............."
+    LC_ALL=C sed "s/%N/%X/" /bin/ls > $TMP/toto
+    $PROG -j 4 /bin/ls $TMP/toto   > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp /bin/ls $TMP/toto > $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f5`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    if cmp_sortie  "/bin/ls $TMP/toto differ: byte $B, line $L";   then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.4 - grands fichiers avec début identique..."
+    cp /bin/ls $TMP/toto ; echo -n "a" >> $TMP/toto
+    $PROG -j 4 $TMP/toto /bin/ls   > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp $TMP/toto /bin/ls 2> $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f10`
+    if cmp_sortie "EOF on /bin/ls after byte $B, line $L";         then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.5 - méthode de lecture invalide............"
+    $PROG -i foo /bin/ls /bin/ls   > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.6 - lecture asynchrone (io_uring, threads)."
+    LC_ALL=C sed "s/%N/%X/" /bin/ls > $TMP/toto
+    LC_ALL=C cmp /bin/ls $TMP/toto > $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f5`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    for BACKEND in uring thread; do
+        COMPARE_PREFETCH=$BACKEND $PROG -i async /bin/ls $TMP/toto > $TMP/stdout 2> $TMP/stderr
+        if check_echec $?;                                              then return 1; fi
+        if cmp_sortie  "/bin/ls $TMP/toto differ: byte $B, line $L";   then return 1; fi
+        cat $TMP/toto | COMPARE_PREFETCH=$BACKEND $PROG -i async /bin/ls /dev/stdin > $TMP/stdout 2> $TMP/stderr
+        if check_echec $?;                                              then return 1; fi
+        if cmp_sortie  "/bin/ls /dev/stdin differ: byte $B, line $L";  then return 1; fi
+        COMPARE_PREFETCH=$BACKEND $PROG -i async /bin/ls /bin/ls > $TMP/stdout 2> $TMP/stderr
+        if check_success $?;                                            then return 1; fi
+    done
+    echo "OK"
+
+    echo -n "Test 4.7 - arborescences identiques..............."
+    mkdir -p $TMP/a/sous $TMP/b
+    cp /bin/ls $TMP/a/sous/ls ; echo "abc" > $TMP/a/abc
+    cp -R $TMP/a/. $TMP/b
+    $PROG -r -j 3 $TMP/a $TMP/b   > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.8 - arborescences différentes.............."
+    echo "acb" > $TMP/b/abc ; echo "x" > $TMP/a/manque ; echo "y" > $TMP/b/sous/plus
+    $PROG -r -j 3 $TMP/a $TMP/b   > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    if cmp_sortie "$TMP/a/abc $TMP/b/abc differ: byte 2, line 1
+$TMP/b/manque is missing
+$TMP/b/sous/plus is extra";                                              then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.9 - cache et fichier modifié..............."
+    cp /bin/ls $TMP/titi ; cp /bin/ls $TMP/toto
+    sleep 3 # les fichiers trop récents ne sont pas mis en cache
+    $PROG -c $TMP/cache $TMP/titi $TMP/toto > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    if ! check_empty $TMP/cache; then echo "échec => cache vide"; return 1; fi
+    $PROG -c $TMP/cache $TMP/titi $TMP/toto > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    echo -n "a" >> $TMP/toto
+    $PROG -c $TMP/cache $TMP/titi $TMP/toto > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp $TMP/titi $TMP/toto 2> $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f10`
+    if cmp_sortie "EOF on $TMP/titi after byte $B, line $L";       then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.10 - mode silencieux......................."
+    $PROG -s $TMP/titi $TMP/toto   > $TMP/stdout 2> $TMP/stderr
+    if [ $? -ne 1 ] || check_empty $TMP/stderr; then echo "échec => -s"; return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.11 - une référence et plusieurs fichiers..."
+    $PROG /bin/ls /bin/ls /bin/ls /bin/ls > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    LC_ALL=C sed "s/%N/%X/" /bin/ls > $TMP/toto
+    cp /bin/ls $TMP/tutu ; echo -n "a" >> $TMP/tutu
+    $PROG /bin/ls $TMP/toto /bin/ls $TMP/tutu /dev/null > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    LC_ALL=C cmp /bin/ls $TMP/toto > $TMP/tmp
+    B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f5`
+    L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    LC_ALL=C cmp /bin/ls $TMP/tutu 2> $TMP/tmp
+    B2=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+    L2=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f10`
+    if cmp_sortie "/bin/ls $TMP/toto differ: byte $B, line $L
+EOF on /bin/ls after byte $B2, line $L2
+EOF on /dev/null which is empty";                                        then return 1; fi
+    echo "OK"
+
+    echo -n "Test 4.12 - fichiers creux........................"
+    rm -f $TMP/titi $TMP/toto $TMP/tutu
+    truncate -s 20M $TMP/titi $TMP/toto
+    echo "abc" | dd of=$TMP/titi bs=1M seek=10 conv=notrunc status=none
+    cp --sparse=never $TMP/titi $TMP/tutu
+    $PROG $TMP/titi $TMP/tutu      > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    for F in "$TMP/titi $TMP/toto" "$TMP/toto $TMP/tutu"; do
+        $PROG $F                   > $TMP/stdout 2> $TMP/stderr
+        if check_echec $?;                                              then return 1; fi
+        LC_ALL=C cmp $F > $TMP/tmp
+        B=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f5`
+        L=`cat $TMP/tmp | tr -d ',' | cut -d ' ' -f7`
+        if cmp_sortie "$F differ: byte $B, line $L";                   then return 1; fi
+    done
+    echo "OK"
+
+    echo -n "Test 4.13 - delta et application.................."
+    { head -c 20000 /bin/ls ; echo "ajout" ; tail -c +40001 /bin/ls ; } > $TMP/toto
+    $PROG -d $TMP/delta /bin/ls /bin/ls > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    $PROG --delta $TMP/delta /bin/ls $TMP/toto > $TMP/stdout 2> $TMP/stderr
+    if check_echec $?;                                                  then return 1; fi
+    if ! grep -q "^/bin/ls $TMP/toto differ: bytes .* replaced by bytes" $TMP/stderr; then
+        echo "échec => région différente non signalée" ; return 1
+    fi
+    $PROG --apply $TMP/delta /bin/ls $TMP/tutu > $TMP/stdout 2> $TMP/stderr
+    if check_success $?;                                                then return 1; fi
+    if ! cmp -s $TMP/toto $TMP/tutu; then echo "échec => delta mal appliqué"; return 1; fi
+    echo "OK"
+}
+
+test_5()
+{
+    echo -n "Test 5 - test mémoire............................."
     valgrind --leak-check=full --error-exitcode=100 $PROG $TMP/titi $TMP/toto > /dev/null 2> $TMP/stderr
     test $? = 100 && echo "échec => log de valgrind dans $TMP/stderr" && return 1
     echo "OK"
@@ -197,11 +361,11 @@ test_4()
 # répertoire temp où sont stockés tous les fichiers et sorties du pg
 mkdir $TMP
 
-# Lance les 4 séries de tests
-for T in $(seq 1 4)
+# Lance les 5 séries de tests
+for T in $(seq 1 5)
 do
 	if test_$T; then
-		echo "== Test $T : ok $T/4\n"
+		echo "== Test $T : ok $T/5\n"
 	else
 		echo "== Test $T : échec"
 		return 1
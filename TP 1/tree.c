@@ -0,0 +1,325 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compare.h"
+
+/*
+ * Recursive comparison of two directory trees (-r).
+ *
+ * Both trees are first walked together with openat(), directory entries in
+ * sorted order, which gives the list of every path to report : missing or
+ * extra files, files of different types, and pairs of regular files to
+ * compare. The pairs are then compared by a pool of threads, while the main
+ * thread prints the list in order as soon as each entry is settled, so that
+ * the output does not depend on the scheduling of the threads.
+ */
+
+#define MAXJOBS 1024
+
+/// what an entry of the list reports
+enum kind_e {
+    ENTRY_MISSING, // in the first tree only
+    ENTRY_EXTRA,   // in the second tree only
+    ENTRY_TYPE,    // not the same type of file
+    ENTRY_LINK,    // symbolic links to different targets
+    ENTRY_FILES,   // regular files to compare
+};
+
+/// one path of the trees
+struct entry_s {
+    enum kind_e kind;
+    char *path1, *path2; // path of the entry in each tree
+    result_t res;        // outcome of the comparison (ENTRY_FILES)
+    int done;            // the entry can be printed
+};
+typedef struct entry_s entry_t;
+
+/// state shared by the walk, the threads and the printer
+struct tree_s {
+    entry_t *entries;
+    size_t nb, cap;
+    options_t pair;     // how to compare a pair of files
+    atomic_size_t next; // next entry to be taken by a thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+typedef struct tree_s tree_t;
+
+static char *join(const char *dir, const char *name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+
+    if (path == NULL)
+        raler(1, "malloc");
+    snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+static void add_entry(tree_t *t, enum kind_e kind, const char *dir1,
+                      const char *dir2, const char *name) {
+    if (t->nb == t->cap) {
+        t->cap = t->cap ? 2 * t->cap : 64;
+        if ((t->entries = realloc(t->entries, t->cap * sizeof(entry_t))) ==
+            NULL)
+            raler(1, "realloc");
+    }
+
+    entry_t *e = &t->entries[t->nb++];
+    e->kind = kind;
+    e->path1 = join(dir1, name);
+    e->path2 = join(dir2, name);
+    e->done = kind != ENTRY_FILES;
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief list the entries of a directory, sorted by name
+ *
+ * @param dfd file descriptor of the directory (left open)
+ * @param path path of the directory (for the error messages)
+ * @param nb number of entries
+ * @return char** - the names, to be freed with their array
+ */
+static char **list_dir(int dfd, const char *path, size_t *nb) {
+    char **names = NULL;
+    size_t cap = 0;
+    struct dirent *d;
+    DIR *dir;
+    int fd;
+
+    CHK(fd = dup(dfd));
+    if ((dir = fdopendir(fd)) == NULL)
+        raler(1, "fdopendir %s", path);
+
+    *nb = 0;
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        if (*nb == cap) {
+            cap = cap ? 2 * cap : 16;
+            if ((names = realloc(names, cap * sizeof(char *))) == NULL)
+                raler(1, "realloc");
+        }
+        if ((names[(*nb)++] = strdup(d->d_name)) == NULL)
+            raler(1, "strdup");
+    }
+
+    CHK(closedir(dir));
+    qsort(names, *nb, sizeof(char *), cmp_names);
+    return names;
+}
+
+/**
+ * @brief 1 if two symbolic links point to different targets
+ *
+ * @param dfd1 directory of the first link
+ * @param dfd2 directory of the second link
+ * @param name name of both links
+ * @return int - 1 if the targets differ, 0 otherwise
+ */
+static int links_differ(int dfd1, int dfd2, const char *name) {
+    char target1[PATH_MAX], target2[PATH_MAX];
+    ssize_t n1, n2;
+
+    CHK(n1 = readlinkat(dfd1, name, target1, sizeof(target1)));
+    CHK(n2 = readlinkat(dfd2, name, target2, sizeof(target2)));
+    return n1 != n2 || memcmp(target1, target2, n1) != 0;
+}
+
+/**
+ * @brief walk two directories together and list what is to be reported
+ *
+ * @param t the shared state
+ * @param dfd1 file descriptor of the first directory
+ * @param dfd2 file descriptor of the second directory
+ * @param dir1 path of the first directory
+ * @param dir2 path of the second directory
+ */
+static void walk(tree_t *t, int dfd1, int dfd2, const char *dir1,
+                 const char *dir2) {
+    size_t n1, n2, i = 0, j = 0;
+    char **names1 = list_dir(dfd1, dir1, &n1);
+    char **names2 = list_dir(dfd2, dir2, &n2);
+
+    while (i < n1 || j < n2) {
+        int c = i == n1 ? 1 : j == n2 ? -1 : strcmp(names1[i], names2[j]);
+
+        if (c < 0) {
+            add_entry(t, ENTRY_MISSING, dir1, dir2, names1[i++]);
+            continue;
+        }
+        if (c > 0) {
+            add_entry(t, ENTRY_EXTRA, dir1, dir2, names2[j++]);
+            continue;
+        }
+
+        const char *name = names1[i];
+        struct stat st1, st2;
+        CHK(fstatat(dfd1, name, &st1, AT_SYMLINK_NOFOLLOW));
+        CHK(fstatat(dfd2, name, &st2, AT_SYMLINK_NOFOLLOW));
+
+        if ((st1.st_mode & S_IFMT) != (st2.st_mode & S_IFMT)) {
+            add_entry(t, ENTRY_TYPE, dir1, dir2, name);
+        } else if (S_ISDIR(st1.st_mode)) {
+            int sub1, sub2;
+            char *path1 = join(dir1, name), *path2 = join(dir2, name);
+            CHK(sub1 = openat(dfd1, name, O_RDONLY | O_DIRECTORY));
+            CHK(sub2 = openat(dfd2, name, O_RDONLY | O_DIRECTORY));
+            walk(t, sub1, sub2, path1, path2);
+            CHK(close(sub1));
+            CHK(close(sub2));
+            free(path1);
+            free(path2);
+        } else if (S_ISREG(st1.st_mode)) {
+            add_entry(t, ENTRY_FILES, dir1, dir2, name);
+        } else if (S_ISLNK(st1.st_mode) && links_differ(dfd1, dfd2, name)) {
+            add_entry(t, ENTRY_LINK, dir1, dir2, name);
+        }
+        // other special files (fifos, devices, sockets) are not read
+
+        i++;
+        j++;
+    }
+
+    for (i = 0; i < n1; i++)
+        free(names1[i]);
+    for (j = 0; j < n2; j++)
+        free(names2[j]);
+    free(names1);
+    free(names2);
+}
+
+/**
+ * @brief thread main loop : compare the next pair of files of the list
+ *
+ * @param arg the shared state
+ * @return void* - NULL
+ */
+static void *worker(void *arg) {
+    tree_t *t = arg;
+    size_t k;
+
+    while ((k = atomic_fetch_add(&t->next, 1)) < t->nb) {
+        entry_t *e = &t->entries[k];
+        int fd1, fd2;
+
+        if (e->kind != ENTRY_FILES)
+            continue;
+
+        CHK(fd1 = open(e->path1, O_RDONLY));
+        CHK(fd2 = open(e->path2, O_RDONLY));
+        compare(fd1, fd2, &t->pair, &e->res);
+        CHK(close(fd1));
+        CHK(close(fd2));
+
+        pthread_mutex_lock(&t->lock);
+        e->done = 1;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief print an entry of the list
+ *
+ * @param e the entry
+ * @param silent 1 to print nothing
+ * @return int - 0 if the entry is identical in both trees, 1 otherwise
+ */
+static int print_entry(const entry_t *e, int silent) {
+    if (silent)
+        return e->kind != ENTRY_FILES || e->res.verdict != SAME;
+
+    switch (e->kind) {
+    case ENTRY_MISSING:
+        fprintf(stderr, "%s is missing\n", e->path2);
+        return 1;
+    case ENTRY_EXTRA:
+        fprintf(stderr, "%s is extra\n", e->path2);
+        return 1;
+    case ENTRY_TYPE:
+        fprintf(stderr, "%s %s differ: file type\n", e->path1, e->path2);
+        return 1;
+    case ENTRY_LINK:
+        fprintf(stderr, "%s %s differ: symbolic link\n", e->path1, e->path2);
+        return 1;
+    case ENTRY_FILES:
+        print_result(stderr, &e->res, e->path1, e->path2);
+        return e->res.verdict != SAME;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief compare two directory trees
+ *
+ * @param dir1 first directory
+ * @param dir2 second directory
+ * @param opts how to compare, jobs being the number of threads of the pool
+ * @return int - 0 if the trees are identical, 1 otherwise
+ */
+int compare_tree(const char *dir1, const char *dir2, const options_t *opts) {
+    pthread_t tids[MAXJOBS];
+    int dfd1, dfd2, r, result = 0;
+    int jobs = opts->jobs;
+    tree_t t;
+
+    if ((dfd1 = open(dir1, O_RDONLY | O_DIRECTORY)) == -1)
+        raler(1, "%s", dir1);
+    if ((dfd2 = open(dir2, O_RDONLY | O_DIRECTORY)) == -1)
+        raler(1, "%s", dir2);
+
+    memset(&t, 0, sizeof(t));
+    t.pair = *opts;
+    t.pair.jobs = 1; // the pool is already as large as wanted
+    atomic_init(&t.next, 0);
+    walk(&t, dfd1, dfd2, dir1, dir2);
+    CHK(close(dfd1));
+    CHK(close(dfd2));
+
+    if ((r = pthread_mutex_init(&t.lock, NULL)) != 0 ||
+        (r = pthread_cond_init(&t.cond, NULL)) != 0)
+        raler(0, "pthread init: %s", strerror(r));
+    if (jobs > MAXJOBS)
+        jobs = MAXJOBS;
+    for (int i = 0; i < jobs; i++)
+        if ((r = pthread_create(&tids[i], NULL, worker, &t)) != 0)
+            raler(0, "pthread_create: %s", strerror(r));
+
+    // print in the order of the walk, whichever thread finishes first
+    for (size_t k = 0; k < t.nb; k++) {
+        entry_t *e = &t.entries[k];
+
+        pthread_mutex_lock(&t.lock);
+        while (!e->done)
+            pthread_cond_wait(&t.cond, &t.lock);
+        pthread_mutex_unlock(&t.lock);
+
+        result |= print_entry(e, opts->silent);
+        free(e->path1);
+        free(e->path2);
+    }
+
+    for (int i = 0; i < jobs; i++)
+        if ((r = pthread_join(tids[i], NULL)) != 0)
+            raler(0, "pthread_join: %s", strerror(r));
+    pthread_mutex_destroy(&t.lock);
+    pthread_cond_destroy(&t.cond);
+    free(t.entries);
+    return result;
+}
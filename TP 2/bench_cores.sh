@@ -0,0 +1,35 @@
+#!/bin/sh
+
+# Compare le mode monoprocesseur et le mode multiprocesseur (-c) sur une même
+# charge : pour 1 cœur puis pour chaque nombre de cœurs donné, affiche la
+# durée totale (makespan) et l'accélération par rapport à un seul cœur.
+#
+# La charge est de $TACHES processus, de durées $DUREES quanta (répétées), le
+# quantum est $QUANTUM.
+#
+# usage : ./bench_cores.sh [cœurs...]    (par défaut : 2, 4 et le nombre de
+#                                         processeurs disponibles)
+
+PROG="./ordonnanceur"
+QUANTUM=${QUANTUM:-5ms}
+TACHES=${TACHES:-64}
+DUREES=${DUREES:-"5 20 10 1"}
+COEURS=${*:-"2 4 $(nproc)"}
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+# makespan en secondes avec $1 cœurs
+makespan ()
+{
+    $PROG -s -c $1 -S $TACHES $QUANTUM $DUREES 2>&1 > /dev/null |
+        sed -n 's/^policy .* quanta in \([0-9.]*\) s.*/\1/p'
+}
+
+echo "quantum=$QUANTUM processus=$TACHES durées=$DUREES processeurs=$(nproc)"
+printf "%-8s %12s %12s\n" "cœurs" "makespan" "accélération"
+UN=$(makespan 1)
+printf "%-8s %11ss %12s\n" 1 $UN 1.00
+for C in $COEURS; do
+    M=$(makespan $C)
+    printf "%-8s %11ss %12s\n" $C $M $(awk "BEGIN { printf \"%.2f\", $UN / $M }")
+done
@@ -0,0 +1,24 @@
+#!/bin/sh
+
+# Compare les politiques d'ordonnancement sur une même charge : des processus
+# courts et longs mélangés. Pour chaque politique, affiche le débit (quanta
+# par seconde) et le temps de séjour moyen et maximal des processus.
+#
+# usage : ./bench_policies.sh [quantum [t0 t1 ...]]
+
+PROG="./ordonnanceur"
+QUANTUM=${1:-2ms}
+[ $# -gt 0 ] && shift
+CHARGE=${*:-"1 20 3 15 2 8 1 30 5 2"}
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+echo "quantum=$QUANTUM charge=$CHARGE"
+printf "%-10s %12s %12s %12s\n" "politique" "quanta/s" "séjour moy" "séjour max"
+for P in rr mlfq lottery srq; do
+    LIGNE=$($PROG -s -p $P $QUANTUM $CHARGE 2>&1 > /dev/null | grep "^policy")
+    DEBIT=$(echo "$LIGNE" | sed 's/.*(\([0-9.]*\) quanta\/s).*/\1/')
+    MOY=$(echo "$LIGNE" | sed 's/.*mean \([0-9.]*\) s.*/\1/')
+    MAX=$(echo "$LIGNE" | sed 's/.*max \([0-9.]*\) s$/\1/')
+    printf "%-10s %12s %12s %12s\n" $P $DEBIT "${MOY}s" "${MAX}s"
+done
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+# Mesure la vitesse du mode simulation (--simulate) de chaque politique sur
+# une trace aléatoire : une arrivée tous les 3 quanta, des durées de 1 à 8
+# quanta et des priorités de 1 à 8. Affiche le nombre d'événements traités
+# par seconde et le temps de séjour moyen (en quanta).
+#
+# usage : ./bench_simulate.sh [nombre de tâches]    (par défaut 1000000)
+
+PROG="./ordonnanceur"
+TACHES=${1:-1000000}
+TRACE="/tmp/$$.trace"
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+awk -v n=$TACHES 'BEGIN {
+    srand(1)
+    for (i = 0; i < n; i++)
+        printf "%d %d %d\n", 3 * i, 1 + int(rand() * 8), 1 + int(rand() * 8)
+}' > $TRACE
+
+echo "tâches=$TACHES"
+printf "%-10s %14s %14s\n" "politique" "M événements/s" "séjour moyen"
+for P in rr mlfq lottery srq; do
+    $PROG --simulate $TRACE -p $P -s 2>&1 > /dev/null | awk -v p=$P '
+        /events\/s/ { debit = $(NF - 2); sub(/\(/, "", debit) }
+        /turnaround mean/ { sejour = $6 }
+        END { printf "%-10s %14s %14s\n", p, debit, sejour }'
+done
+
+rm -f $TRACE
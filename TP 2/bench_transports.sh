@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# Compare les transports entre l'ordonnanceur et les processus : signaux
+# (SIGUSR1/SIGUSR2) ou futex sur un bloc de contrôle partagé. Quelques
+# processus longs, pour ne mesurer que les commutations (sans fork). Pour
+# chaque transport, affiche la latence d'une commutation (de la fin d'un
+# quantum au processus suivant en exécution) et le temps processeur du père
+# par commutation.
+#
+# usage : ./bench_transports.sh [quantum [t0 t1 ...]]
+
+PROG="./ordonnanceur"
+QUANTUM=${1:-100us}
+[ $# -gt 0 ] && shift
+CHARGE=${*:-"500 500 500 500"}
+
+[ ! -x $PROG ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+echo "quantum=$QUANTUM charge=$CHARGE"
+printf "%-10s %12s %12s %12s %12s\n" "transport" "latence p50" "latence p99" "latence max" "cpu père"
+for T in signal futex; do
+    $PROG -s -t $T $QUANTUM $CHARGE 2>&1 > /dev/null | awk -v t=$T '
+        / switches, overhead/ { cpu = $(NF - 1) }
+        /^transport/ {
+            for (i = 1; i <= NF; i++) {
+                split($i, kv, "=")
+                if (kv[1] == "p50") p50 = kv[2]
+                if (kv[1] == "p99") p99 = kv[2]
+                if (kv[1] == "max") max = kv[2]
+            }
+        }
+        END { printf "%-10s %10sus %10sus %10sus %10sus\n", t, p50, p99, max, cpu }'
+done
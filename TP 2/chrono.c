@@ -2,100 +2,459 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
 
 /*
  * Un petit programme pour implémenter un chronomètre :
  * Syntaxe :
- *      ./a.out                 // affiche la date correspondant à maintenant
+ *      ./a.out                 // affiche l'instant correspondant à maintenant
  *      ./a.out t1              // affiche la durée entre t1 et maintenant
  *      ./a.out t1 min max      // code retour = 0 si durée \in [min, max]
+ *      ./a.out -n ...          // idem, mais les durées sont affichées en ns
+ *      ./a.out -c              // vérifie l'horloge, code retour = 0 si ok
+ *      ./a.out run [-n N] [-w W] [-p P -m min -M max] -- cmd [args]
+ *                              // exécute cmd W fois pour rien, puis N fois
+ *                              // en mesurant temps réel, user, sys et
+ *                              // mémoire ; code retour = 0 si le percentile
+ *                              // P des temps réels \in [min, max]
  *
- * Tous les temps sont indiqués en ms
+ * Tous les temps sont indiqués en ms, avec 6 décimales (soit la ns)
+ *
+ * L'horloge est CLOCK_MONOTONIC_RAW : elle ne saute pas quand l'heure du
+ * système est changée et n'est pas accélérée ou ralentie par NTP. Un instant
+ * n'est donc pas une date, il n'a de sens que sur la même machine, depuis
+ * son démarrage. Les temps sont conservés en nombres entiers de ns.
  */
 
 #define MILLION         (1000*1000L)
+#define MILLIARD        (1000*1000*1000L)
+#define HORLOGE         CLOCK_MONOTONIC_RAW
+
+#define NB_LECTURES     (1000*1000)     // pour la vérification de l'horloge
+#define PAUSE           (50*MILLION)    // idem, en ns
 
-typedef long double temps ;     // un point dans le temps ou une durée
+typedef int64_t temps ;         // un point dans le temps ou une durée, en ns
 
-struct timespec_ms              // idem timespec, mais en ms
+void erreur_temps (const char *str)
 {
-    intmax_t tv_msec ;          // nb de ms
-    intmax_t tv_usec ;          // nb de microsecondes dans la dernière ms
-} ;
+    fprintf (stderr, "date invalide (%s)\n", str) ;
+    exit (1) ;
+}
+
+/*
+ * Lit un temps en ms, avec au plus 6 décimales (les suivantes sont
+ * ignorées) : c'est le format de l'instant affiché au démarrage
+ */
 
 temps lire_temps (const char *str)
 {
-    temps t ;
-    int n ;
+    const char *p = str ;
+    temps ms = 0, ns = 0, unite = MILLION ;
+    int signe = 1, chiffres = 0 ;
 
-    n = sscanf (str, "%Lf", &t) ;
-    if (n == 0)
+    if (*p == '-')
     {
-        fprintf (stderr, "date invalide (%s)\n", str) ;
-        exit (1) ;
+        signe = -1 ;
+        p++ ;
     }
-    return t ;
+    for ( ; *p >= '0' && *p <= '9' ; p++, chiffres++)
+    {
+        if (ms > (INT64_MAX / MILLION - 9) / 10)
+            erreur_temps (str) ;
+        ms = ms * 10 + (*p - '0') ;
+    }
+    if (*p == '.')
+        for (p++ ; *p >= '0' && *p <= '9' ; p++, chiffres++)
+            if ((unite /= 10) > 0)
+                ns += (*p - '0') * unite ;
+    if (chiffres == 0 || *p != '\0')
+        erreur_temps (str) ;
+
+    return signe * (ms * MILLION + ns) ;
 }
 
-void lire_horloge (struct timespec_ms *tms)
+temps lire_horloge (clockid_t horloge)
 {
     struct timespec ts ;
 
-    clock_gettime (CLOCK_REALTIME, &ts) ;
-    tms->tv_msec = (intmax_t)ts.tv_sec*1000 + (intmax_t)ts.tv_nsec/MILLION ;
-    tms->tv_usec = (intmax_t)ts.tv_nsec % MILLION ;
+    if (clock_gettime (horloge, &ts) == -1)
+    {
+        perror ("clock_gettime") ;
+        exit (1) ;
+    }
+    return (temps) ts.tv_sec * MILLIARD + ts.tv_nsec ;
+}
+
+/*
+ * Écrit un temps en ms avec 6 décimales, relisible par lire_temps, ou en ns
+ */
+
+char *ecrire_temps (temps t, int en_ns, char *buf, size_t taille)
+{
+    intmax_t a = t < 0 ? -(intmax_t) t : t ;
+
+    if (en_ns)
+        snprintf (buf, taille, "%jd", (intmax_t) t) ;
+    else
+        snprintf (buf, taille, "%s%jd.%06jd", t < 0 ? "-" : "",
+                                a / MILLION, a % MILLION) ;
+    return buf ;
 }
 
 temps duree (const char *str)
 {
-    struct timespec_ms tms ;
     temps t1, t2 ;
 
     t1 = lire_temps (str) ;
-    lire_horloge (&tms) ;
-    t2 = tms.tv_msec + tms.tv_usec / (temps) MILLION ;
+    t2 = lire_horloge (HORLOGE) ;
     return t2 - t1 ;
 }
 
+/*
+ * Vérifie l'horloge : sa résolution, le coût d'une lecture, qu'elle ne
+ * recule pas, et sa dérive par rapport à CLOCK_MONOTONIC (corrigée par NTP).
+ * Sur x86-64, la fréquence du TSC est aussi mesurée sur deux intervalles,
+ * pour information.
+ */
+
+int verifier_horloge (void)
+{
+    struct timespec res, pause = { 0, PAUSE } ;
+    temps debut, prec, t, pas_min = INT64_MAX ;
+    temps brut [3], mono [3] ;
+    long reculs = 0 ;
+    double ppm ;
+    int r = 0 ;
+#ifdef __x86_64__
+    uint64_t tsc [3] ;
+    double mhz [2] ;
+#endif
+
+    if (clock_getres (HORLOGE, &res) == -1)
+    {
+        perror ("clock_getres") ;
+        exit (1) ;
+    }
+    printf ("horloge CLOCK_MONOTONIC_RAW : résolution %jd ns\n",
+            (intmax_t) res.tv_sec * MILLIARD + res.tv_nsec) ;
+    if (res.tv_sec > 0 || res.tv_nsec > 1000)
+    {
+        fprintf (stderr, "résolution supérieure à 1 us\n") ;
+        r = 1 ;
+    }
+
+    debut = prec = lire_horloge (HORLOGE) ;
+    for (int i = 0 ; i < NB_LECTURES ; i++)
+    {
+        t = lire_horloge (HORLOGE) ;
+        if (t < prec)
+            reculs++ ;
+        else if (t > prec && t - prec < pas_min)
+            pas_min = t - prec ;
+        prec = t ;
+    }
+    printf ("lecture : %.1f ns, plus petit pas %jd ns, %ld recul(s) sur %d "
+            "lectures\n", (double) (prec - debut) / NB_LECTURES,
+            (intmax_t) pas_min, reculs, NB_LECTURES) ;
+    if (reculs > 0)
+    {
+        fprintf (stderr, "l'horloge recule\n") ;
+        r = 1 ;
+    }
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        if (i > 0)
+            nanosleep (&pause, NULL) ;
+        brut [i] = lire_horloge (HORLOGE) ;
+        mono [i] = lire_horloge (CLOCK_MONOTONIC) ;
+#ifdef __x86_64__
+        tsc [i] = __rdtsc () ;
+#endif
+    }
+
+    // NTP corrige CLOCK_MONOTONIC de 500 ppm au plus
+    ppm = ((brut [2] - brut [0]) - (mono [2] - mono [0])) * 1e6
+          / (mono [2] - mono [0]) ;
+    printf ("dérive par rapport à CLOCK_MONOTONIC : %+.1f ppm sur %ld ms\n",
+            ppm, 2 * PAUSE / MILLION) ;
+    if (ppm > 1000 || ppm < -1000)
+    {
+        fprintf (stderr, "dérive supérieure à 1000 ppm\n") ;
+        r = 1 ;
+    }
+
+#ifdef __x86_64__
+    for (int i = 0 ; i < 2 ; i++)
+        mhz [i] = (double) (tsc [i+1] - tsc [i]) * 1e3
+                  / (brut [i+1] - brut [i]) ;
+    printf ("TSC : %.3f MHz, écart entre deux mesures %.1f ppm\n", mhz [1],
+            (mhz [1] - mhz [0]) * 1e6 / mhz [0]) ;
+#endif
+
+    if (r == 0)
+        printf ("ok\n") ;
+    return r ;
+}
+
+/*
+ * Mesure répétée d'une commande : chaque exécution est lancée par fork et
+ * exec, sans passer par le shell, et attendue par wait4 qui en donne le
+ * temps user et sys et la mémoire maximale (rss)
+ */
+
+enum { REEL, USER, SYS, RSS, NB_MESURES } ;
+
+const char *nom_mesure [NB_MESURES] = { "wall", "user", "sys", "rss" } ;
+
+int cmp_temps (const void *a, const void *b)
+{
+    temps x = *(const temps *) a, y = *(const temps *) b ;
+
+    return (x > y) - (x < y) ;
+}
+
+// valeur au percentile p (rang le plus proche) de n valeurs triées
+temps percentile (const temps *v, int n, double p)
+{
+    double rang = p * n / 100 ;
+    int k = (int) rang ;
+
+    if (k < rang || k == 0)
+        k++ ;
+    return v [k - 1] ;
+}
+
+void executer (char *cmd [], temps mesure [NB_MESURES])
+{
+    struct rusage ru ;
+    temps debut ;
+    pid_t pid ;
+    int st ;
+
+    debut = lire_horloge (HORLOGE) ;
+    switch (pid = fork ())
+    {
+        case -1 :
+            perror ("fork") ;
+            exit (1) ;
+
+        case 0 :
+            execvp (cmd [0], cmd) ;
+            perror (cmd [0]) ;
+            _exit (127) ;
+    }
+    if (wait4 (pid, &st, 0, &ru) == -1)
+    {
+        perror ("wait4") ;
+        exit (1) ;
+    }
+    mesure [REEL] = lire_horloge (HORLOGE) - debut ;
+
+    if (! WIFEXITED (st) || WEXITSTATUS (st) != 0)
+    {
+        fprintf (stderr, "%s : code de retour %d\n", cmd [0],
+                 WIFEXITED (st) ? WEXITSTATUS (st) : 128 + WTERMSIG (st)) ;
+        exit (1) ;
+    }
+    mesure [USER] = (temps) ru.ru_utime.tv_sec * MILLIARD
+                    + ru.ru_utime.tv_usec * 1000 ;
+    mesure [SYS] = (temps) ru.ru_stime.tv_sec * MILLIARD
+                   + ru.ru_stime.tv_usec * 1000 ;
+    mesure [RSS] = ru.ru_maxrss ;      // en Ko
+}
+
+int run (int argc, char *argv [], int en_ns)
+{
+    temps *v [NB_MESURES], mesure [NB_MESURES], min = 0, max = 0, x ;
+    double p = -1, somme, carres ;
+    char buf [6][32], *fin ;
+    int n = 10, w = 1, opt, r = 0 ;
+
+    while ((opt = getopt (argc, argv, "+n:w:p:m:M:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n' :
+            case 'w' :
+                x = strtol (optarg, &fin, 10) ;
+                if (*optarg == '\0' || *fin != '\0' || x < 0 || x > 1000000
+                    || (opt == 'n' && x == 0))
+                {
+                    fprintf (stderr, "nombre invalide (%s)\n", optarg) ;
+                    return 1 ;
+                }
+                *(opt == 'n' ? &n : &w) = x ;
+                break ;
+
+            case 'p' :
+                p = strtod (optarg, &fin) ;
+                if (*optarg == '\0' || *fin != '\0' || ! (p > 0 && p <= 100))
+                {
+                    fprintf (stderr, "percentile invalide (%s)\n", optarg) ;
+                    return 1 ;
+                }
+                break ;
+
+            case 'm' :
+                min = lire_temps (optarg) ;
+                break ;
+
+            case 'M' :
+                max = lire_temps (optarg) ;
+                break ;
+
+            default :
+                return 1 ;
+        }
+    }
+    if (optind == argc)
+    {
+        fprintf (stderr, "usage: chrono run [-n N] [-w W] "
+                         "[-p P -m min -M max] -- cmd [args]\n") ;
+        return 1 ;
+    }
+
+    for (int i = 0 ; i < NB_MESURES ; i++)
+        if ((v [i] = malloc (n * sizeof (temps))) == NULL)
+        {
+            perror ("malloc") ;
+            exit (1) ;
+        }
+
+    for (int k = 0 ; k < w ; k++)
+        executer (argv + optind, mesure) ;
+    for (int k = 0 ; k < n ; k++)
+    {
+        executer (argv + optind, mesure) ;
+        for (int i = 0 ; i < NB_MESURES ; i++)
+            v [i][k] = mesure [i] ;
+    }
+
+    printf ("%s : %d exécutions mesurées, %d d'échauffement\n",
+            argv [optind], n, w) ;
+    printf ("%-10s %14s %15s %14s %14s %14s %14s\n", "", "moyenne",
+            "écart-type", "p50", "p90", "p99", "max") ;
+    for (int i = 0 ; i < NB_MESURES ; i++)
+    {
+        int ns = en_ns && i != RSS ;
+        double unite = i == RSS || ns ? 1 : MILLION ;
+
+        somme = carres = 0 ;
+        for (int k = 0 ; k < n ; k++)
+            somme += v [i][k] ;
+        for (int k = 0 ; k < n ; k++)
+            carres += (v [i][k] - somme / n) * (v [i][k] - somme / n) ;
+        qsort (v [i], n, sizeof (temps), cmp_temps) ;
+
+        snprintf (buf [0], sizeof buf [0], "%s (%s)", nom_mesure [i],
+                  i == RSS ? "Ko" : ns ? "ns" : "ms") ;
+        printf ("%-10s %14.3f %14.3f", buf [0], somme / n / unite,
+                n > 1 ? sqrt (carres / (n - 1)) / unite : 0) ;
+        if (i == RSS)
+            printf (" %14jd %14jd %14jd %14jd\n",
+                    (intmax_t) percentile (v [i], n, 50),
+                    (intmax_t) percentile (v [i], n, 90),
+                    (intmax_t) percentile (v [i], n, 99),
+                    (intmax_t) v [i][n - 1]) ;
+        else
+            printf (" %14s %14s %14s %14s\n",
+                    ecrire_temps (percentile (v [i], n, 50), ns, buf [2], 32),
+                    ecrire_temps (percentile (v [i], n, 90), ns, buf [3], 32),
+                    ecrire_temps (percentile (v [i], n, 99), ns, buf [4], 32),
+                    ecrire_temps (v [i][n - 1], ns, buf [5], 32)) ;
+    }
+
+    // le contrôle porte sur un percentile du temps réel, pas sur un seul
+    // échantillon
+    if (p > 0)
+    {
+        x = percentile (v [REEL], n, p) ;
+        ecrire_temps (x, en_ns, buf [0], sizeof buf [0]) ;
+        ecrire_temps (min, en_ns, buf [1], sizeof buf [1]) ;
+        ecrire_temps (max, en_ns, buf [2], sizeof buf [2]) ;
+        if (x < min)
+        {
+            fprintf (stderr, "p%g=%s < %s (min)\n", p, buf [0], buf [1]) ;
+            r = 1 ;
+        }
+        else if (x > max)
+        {
+            fprintf (stderr, "p%g=%s > %s (max)\n", p, buf [0], buf [2]) ;
+            r = 1 ;
+        }
+        else printf ("p%g=%s ok\n", p, buf [0]) ;
+    }
+
+    for (int i = 0 ; i < NB_MESURES ; i++)
+        free (v [i]) ;
+    return r ;
+}
+
 int main (int argc, char *argv [])
 {
-    struct timespec_ms tms ;
+    char *prog = argv [0] ;
+    char buf [3][32] ;
     temps d ;
     temps min, max ;
+    int en_ns = 0 ;
     int r = 0 ;
 
+    if (argc == 2 && strcmp (argv [1], "-c") == 0)
+        exit (verifier_horloge ()) ;
+    if (argc > 1 && strcmp (argv [1], "-n") == 0)
+    {
+        en_ns = 1 ;
+        argc-- ;
+        argv++ ;
+    }
+    if (argc > 1 && strcmp (argv [1], "run") == 0)
+        exit (run (argc - 1, argv + 1, en_ns)) ;
+
     switch (argc)
     {
-        case 1 :        // démarrer le chrono => date-début
-            lire_horloge (&tms) ;
-            printf ("%jd.%06jd\n",(intmax_t)tms.tv_msec,(intmax_t)tms.tv_usec) ;
+        case 1 :        // démarrer le chrono => instant-début, toujours en ms
+            printf ("%s\n", ecrire_temps (lire_horloge (HORLOGE), 0,
+                                          buf [0], sizeof buf [0])) ;
             break ;
 
-        case 2 :        // date-début => durée (= maintenant - début)
+        case 2 :        // instant-début => durée (= maintenant - début)
             d = duree (argv [1]) ;
-            printf ("%Lf\n", d) ;
+            printf ("%s\n", ecrire_temps (d, en_ns, buf [0], sizeof buf [0])) ;
             break ;
 
-        case 4 :        // date-début min max => durée+exit(0) OU erreur+exit(1)
+        case 4 :        // début min max => durée+exit(0) OU erreur+exit(1)
             d = duree (argv [1]) ;
             min = lire_temps (argv [2]) ;
             max = lire_temps (argv [3]) ;
+            ecrire_temps (d, en_ns, buf [0], sizeof buf [0]) ;
+            ecrire_temps (min, en_ns, buf [1], sizeof buf [1]) ;
+            ecrire_temps (max, en_ns, buf [2], sizeof buf [2]) ;
             if (d < min)
             {
-                fprintf (stderr, "durée=%Lf < %Lf (min)\n", d, min) ;
+                fprintf (stderr, "durée=%s < %s (min)\n", buf [0], buf [1]) ;
                 r = 1 ;
             }
             else if (d > max)
             {
-                fprintf (stderr, "durée=%Lf > %Lf (max)\n", d, max) ;
+                fprintf (stderr, "durée=%s > %s (max)\n", buf [0], buf [2]) ;
                 r = 1 ;
             }
-            else printf ("%Lf ok\n", d) ;
+            else printf ("%s ok\n", buf [0]) ;
             break ;
 
         default :
-            fprintf (stderr, "usage: %s [début [min max]]\n", argv [0]) ;
+            fprintf (stderr, "usage: %s [-n] [début [min max]]\n"
+                             "       %s [-n] run [-n N] [-w W] "
+                             "[-p P -m min -M max] -- cmd [args]\n"
+                             "       %s -c\n", prog, prog, prog) ;
             r = 1 ;
             break ;
 
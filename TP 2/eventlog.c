@@ -0,0 +1,129 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "eventlog.h"
+
+const char *const event_names[] = {"SURP", "EVIP", "TERM"};
+
+/// an event, 16 bytes
+struct record_s {
+    int64_t ts;       // CLOCK_MONOTONIC (ns)
+    atomic_uint seq;  // position in the log + 1 (mod 2^32) once written
+    int32_t task_type; // task << 2 | type
+};
+
+/// the log, at the start of the shared mapping
+struct eventlog_s {
+    _Alignas(64) atomic_ulong head; // events appended so far
+    size_t mask;                    // capacity - 1, a power of 2
+    size_t size;                    // of the mapping
+    _Alignas(64) struct record_s records[];
+};
+
+eventlog_t *eventlog_create(size_t capacity) {
+    size_t cap = 1024, size;
+    eventlog_t *log;
+
+    while (cap < capacity)
+        cap *= 2;
+    size = sizeof(eventlog_t) + cap * sizeof(struct record_s);
+
+    log = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+               -1, 0);
+    if (log == MAP_FAILED)
+        alert(1, "mmap");
+    log->mask = cap - 1;
+    log->size = size;
+    return log;
+}
+
+void eventlog_destroy(eventlog_t *log) {
+    if (munmap(log, log->size) == -1)
+        alert(1, "munmap");
+}
+
+void eventlog_append(eventlog_t *log, int type, int task) {
+    unsigned long pos = atomic_fetch_add_explicit(&log->head, 1,
+                                                  memory_order_relaxed);
+    struct record_s *r = &log->records[pos & log->mask];
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r->ts = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    r->task_type = task << 2 | type;
+    atomic_store_explicit(&r->seq, (unsigned)(pos + 1), memory_order_release);
+}
+
+void eventlog_decode(eventlog_t *log, FILE *out, int json) {
+    unsigned long head = atomic_load(&log->head), first = 0, pos;
+    unsigned long lost = 0;
+    int64_t t0 = 0, *running = NULL;
+    int max_task = -1, sep = 0;
+
+    if (head > log->mask + 1)
+        lost = first = head - (log->mask + 1);
+
+    // a Chrome trace shows a run from SURP to EVIP (or TERM), so the start of
+    // the current run of each task is needed
+    if (json) {
+        for (pos = first; pos < head; pos++) {
+            struct record_s *r = &log->records[pos & log->mask];
+            if ((r->task_type >> 2) > max_task)
+                max_task = r->task_type >> 2;
+        }
+        if ((running = malloc(sizeof(int64_t) * (max_task + 1))) == NULL)
+            alert(0, "malloc");
+        for (int k = 0; k <= max_task; k++)
+            running[k] = -1;
+        t0 = head > first ? log->records[first & log->mask].ts : 0;
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    }
+
+    for (pos = first; pos < head; pos++) {
+        struct record_s *r = &log->records[pos & log->mask];
+        int task = r->task_type >> 2, type = r->task_type & 3;
+        double us = (r->ts - t0) / 1e3;
+
+        // not published, or overwritten
+        if (atomic_load_explicit(&r->seq, memory_order_acquire) !=
+            (unsigned)(pos + 1)) {
+            lost++;
+            continue;
+        }
+
+        if (!json) {
+            fprintf(out, "%s - process %d\n", event_names[type], task);
+            continue;
+        }
+
+        if (type == EVENT_SURP) {
+            running[task] = r->ts;
+            continue;
+        }
+        if (running[task] != -1) {
+            fprintf(out,
+                    "%s{\"name\":\"process %d\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    sep ? ",\n" : "", task, task, (running[task] - t0) / 1e3,
+                    (r->ts - running[task]) / 1e3);
+            running[task] = -1;
+            sep = 1;
+        }
+        if (type == EVENT_TERM) {
+            fprintf(out,
+                    "%s{\"name\":\"TERM\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.3f}",
+                    sep ? ",\n" : "", task, us);
+            sep = 1;
+        }
+    }
+
+    if (json) {
+        fprintf(out, "\n]}\n");
+        free(running);
+    }
+    if (lost > 0)
+        fprintf(stderr, "event log: %lu events lost\n", lost);
+}
@@ -0,0 +1,42 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+/*
+ * Binary log of the events of the ordonnanceur (-L) : a ring of records in a
+ * shared mapping, inherited by the children. Every process appends to it
+ * without lock nor system call but clock_gettime (vDSO), instead of printing
+ * and flushing a line. The parent decodes the log once every process is done,
+ * as the usual text or as a Chrome trace (JSON, for chrome://tracing or
+ * Perfetto).
+ *
+ * A record is reserved by an atomic increment of the head, then published by
+ * writing its sequence number last. If more events than the capacity are
+ * appended, the oldest ones are overwritten and reported as lost.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdnoreturn.h>
+
+// print an error message (and errno if syserr == 1) then exit(1)
+noreturn void alert(int syserr, const char *msg, ...);
+
+// the events
+#define EVENT_SURP 0 // a process is sent running
+#define EVENT_EVIP 1 // a process is stopped
+#define EVENT_TERM 2 // a process has terminated
+
+extern const char *const event_names[];
+
+typedef struct eventlog_s eventlog_t;
+
+// create a log for capacity events at least, shared with the children
+eventlog_t *eventlog_create(size_t capacity);
+void eventlog_destroy(eventlog_t *log);
+// append an event of a process, stamped with CLOCK_MONOTONIC
+void eventlog_append(eventlog_t *log, int type, int task);
+// print the events in the order they were appended, as text or JSON
+void eventlog_decode(eventlog_t *log, FILE *out, int json);
+
+#endif
@@ -0,0 +1,72 @@
+#include <inttypes.h>
+
+#include "hist.h"
+
+// greatest value counted in a bucket
+static int64_t bucket_max(int b) {
+    int e = b / HIST_SUB - 1;
+
+    if (b < 2 * HIST_SUB)
+        return b;
+    return ((int64_t)(b % HIST_SUB + HIST_SUB) << e) + ((int64_t)1 << e) - 1;
+}
+
+/**
+ * @brief find the bucket of a percentile
+ *
+ * @param h the histogram, not empty
+ * @param pct the percentile, from 0 to 100
+ * @param below number of values up to the bucket, included
+ * @return int64_t - the greatest value of the bucket, at most the max
+ */
+static int64_t percentile_of(const hist_t *h, double pct, uint64_t *below) {
+    double rank = pct / 100 * h->nb;
+    uint64_t target = (uint64_t)rank, n = 0;
+    int b;
+
+    if (target < rank || target == 0)
+        target++;
+    // target is at most the number of values, the loop ends
+    for (b = 0; (n += h->counts[b]) < target; b++)
+        ;
+    *below = n;
+    return bucket_max(b) < h->max ? bucket_max(b) : h->max;
+}
+
+int64_t hist_percentile(const hist_t *h, double pct) {
+    uint64_t below;
+
+    return h->nb == 0 ? 0 : percentile_of(h, pct, &below);
+}
+
+void hist_print_line(const hist_t *h, FILE *out, double unit) {
+    static const double pcts[] = {50, 90, 99, 99.9};
+
+    for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+        fprintf(out, " p%g=%.1f", pcts[i], hist_percentile(h, pcts[i]) / unit);
+    fprintf(out, " max=%.1f\n", h->max / unit);
+}
+
+void hist_print(const hist_t *h, FILE *out, const char *title, double unit) {
+    uint64_t below = 0;
+    double pct = 0;
+
+    if (h->nb == 0)
+        return;
+
+    fprintf(out, "%s: %" PRIu64 " values, mean %.3f, max %.3f\n", title, h->nb,
+            (double)h->sum / h->nb / unit, h->max / unit);
+    fprintf(out, "%12s %12s %10s %10s\n", "value", "percentile", "count",
+            "1/(1-p)");
+
+    // closer and closer to the max, as HdrHistogram does
+    for (int i = 1; below < h->nb && i <= 24; i++) {
+        int64_t v = percentile_of(h, pct, &below);
+
+        fprintf(out, "%12.3f %12.6f %10" PRIu64 " %10.2f\n", v / unit,
+                pct / 100, below, 100 / (100 - pct));
+        pct = 100 - 100.0 / (1 << i);
+    }
+    fprintf(out, "%12.3f %12.6f %10" PRIu64 " %10s\n", h->max / unit, 1.0,
+            h->nb, "inf");
+}
@@ -0,0 +1,58 @@
+#ifndef HIST_H
+#define HIST_H
+
+/*
+ * Histograms of durations in the manner of HdrHistogram : the values below
+ * 2 * HIST_SUB are counted exactly, the larger ones in HIST_SUB buckets per
+ * power of 2, so that a percentile is read within 1 / HIST_SUB (3 %) of the
+ * value. Recording is a few instructions without allocation, and the size is
+ * fixed whatever the number of values : the ordonnanceur records all the
+ * time, not only with -s.
+ *
+ * A histogram filled with zeros is empty.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS) * HIST_SUB)
+
+typedef struct hist_s {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t nb;  // number of values
+    int64_t sum;  // of the values, for the mean
+    int64_t max;  // exact greatest value
+} hist_t;
+
+// bucket of a value, the negative ones count as 0
+static inline int hist_bucket(int64_t v) {
+    int e;
+
+    if (v < 2 * HIST_SUB)
+        return v < 0 ? 0 : v;
+    e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (e + 1) * HIST_SUB + (int)(v >> e) - HIST_SUB;
+}
+
+static inline void hist_record(hist_t *h, int64_t v) {
+    if (v < 0)
+        v = 0;
+    h->counts[hist_bucket(v)]++;
+    h->nb++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+// value at a percentile (0 to 100) : the greatest value of its bucket, or the
+// greatest value recorded
+int64_t hist_percentile(const hist_t *h, double pct);
+// print p50, p90, p99, p99.9 and max on a line, the values divided by unit
+void hist_print_line(const hist_t *h, FILE *out, double unit);
+// print the percentile distribution, from p0 to the max with the distance
+// to 100 % halved at each line, the values divided by unit
+void hist_print(const hist_t *h, FILE *out, const char *title, double unit);
+
+#endif
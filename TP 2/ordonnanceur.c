@@ -1,22 +1,41 @@
+#define _GNU_SOURCE // sched_setaffinity
+
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 #include <wait.h>
 
+#include "eventlog.h"
+#include "hist.h"
+#include "pidmap.h"
+#include "policy.h"
+#include "simulate.h"
+
 #define CHK(op)            \
     do {                   \
         if ((op) == -1)    \
@@ -37,90 +56,281 @@ noreturn void alert(int syserr, const char *msg, ...) {
     exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief current time of CLOCK_MONOTONIC
+ *
+ * @return int64_t - the time in ns
+ */
+int64_t now_ns(void) {
+    struct timespec ts;
+
+    CHK(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief cpu time used by the (single threaded) process so far
+ *
+ * @return int64_t - the time in ns
+ */
+int64_t cpu_ns(void) {
+    struct timespec ts;
+
+    CHK(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts));
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief sleep while a futex word holds a value (or until woken)
+ *
+ * @param addr the futex word, in memory shared by the processes
+ * @param val the value expected
+ */
+void futex_wait(atomic_uint *addr, unsigned val) {
+    // glibc has no wrapper for futex(2)
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+        errno != EAGAIN && errno != EINTR)
+        alert(1, "futex_wait");
+}
+
+/**
+ * @brief wake the process waiting on a futex word, if any
+ *
+ * @param addr the futex word, in memory shared by the processes
+ */
+void futex_wake(atomic_uint *addr) {
+    CHK(syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0));
+}
+
+/// control block of a process, shared with the parent : the doorbells of the
+/// futex transport (-t futex), and when the process runs in both transports
+struct doorbell_s {
+    _Alignas(64) atomic_uint run; // quanta to run, 0 once the child has read it
+    atomic_uint stop;             // the parent asks for the end of the quantum
+    atomic_uint done;             // the child stopped
+    int64_t running;              // the child started its last run (ns)
+};
+
+/// what the parent knows of a process, kept small for large batches
+struct task_s {
+    pid_t pid;     // 0 until launched, -1 once terminated
+    int remaining; // quanta left to run
+    int core;      // core whose queue holds the process, or running it
+};
+
+/// what the parent measures of a process, 64 bytes
+struct usage_s {
+    int64_t launched;    // the process was forked then (ns)
+    int64_t response_ns; // from its fork to its first run
+    int64_t run_ns;      // time the process was given the cpu
+    int64_t wall_ns;     // from its fork to its end
+    int64_t cpu_ns;      // user and system time it consumed (wait4)
+    int64_t delivery_ns; // from the start of its quanta to it running
+    int nb_runs;         // quanta started
+    int nb_preempted;    // runs stopped before the process was done
+    int status;          // exit status
+};
+
+/// a core of the multi-cpu mode (-c), running a process at a time
+struct core_s {
+    int cpu;          // cpu the processes are pinned to, -1 if not pinned
+    int tfd;          // timerfd ending the quantum
+    policy_t *policy; // the processes ready on this core
+    int nb_ready;     // number of processes in the queue, to steal from
+    int index;        // the process running, -1 if none
+    long slices;      // length of the quantum, in quanta
+    int tick, donned; // the quantum ended, the process stopped
+    int64_t start;    // start of the quantum
+    int64_t stopped;  // the running process stopped then, -1 if not yet
+    int64_t launch_ns; // env->launch_ns then, to leave the forks out
+    int64_t ticked;   // end of the last quantum, when the next one starts
+    int64_t switch_from; // ticked for the current quantum
+    int64_t busy_ns;  // time processes ran on the core
+    long nb_quanta;   // quanta run on the core
+};
+
 struct env_s {
-    long qt;          // quantum duration
-    pid_t *pids;      // array of pids
+    long qt;          // quantum duration (in microseconds)
+    int stats;        // print statistics at exit (-s)
+    hist_t jitter;    // achieved - requested duration of each quantum
+    hist_t latency;   // end of a quantum - start of the next run
+    hist_t delivery;  // start of a quantum - the process running
+    hist_t response;  // fork of a process - its first run
+    hist_t waiting;   // time a process was ready but not running
+    struct task_s *tasks; // the processes, by index
+    struct doorbell_s *bells; // control blocks of the processes, shared
+    int futex;        // the doorbells start and stop the processes (-t futex)
+    char **commands;  // command of each process, NULL for synthetic ones (-x)
+    struct usage_s *usage; // measures of each process
     int nb_processes; // number of processes
+    int nb_launched;  // processes 0 to nb_launched - 1 have been forked
+    pidmap_t alive;   // index of the processes launched and not yet waited
+    struct core_s *cores; // the cores, each with its queue (-p) and timer
+    int nb_cores;     // processes running at most at once (-c)
+    long nb_steals;   // processes taken from the queue of another core
+    int64_t t0;       // start of the scheduling (ns)
+    int64_t turnaround_sum, turnaround_max; // end of the processes - t0 (ns)
+    long nb_quanta;   // quanta run
+    long nb_switches; // a process stopped and the next one started
+    int64_t switch_ns; // time from the stop of a process to the next start
+    int64_t cpu0;      // cpu time of the parent at the start (ns)
+    int64_t launch_ns, launch_cpu; // time and cpu time spent forking (ns)
+    int epfd;         // epoll instance watching the descriptors below
+    int sfd;          // signalfd receiving SIGRTMIN (child stopped) and SIGCHLD
 };
 // holds the parent process needed information
 typedef struct env_s env_t;
 
+#define USAGE                                                                \
+    "usage: %s [-p policy] [-t signal|futex] [-c cores] [-s] [-S tasks] "    \
+    "[-L text|json] <t> t0 [t1] [t2] ...\n"                                   \
+    "       %s -x [-p policy] [-c cores] [-s] [-S tasks] [-L text|json] <t> " \
+    "cmd0 [cmd1] ...\n"                                                       \
+    "       %s --simulate trace [-p policy] [-s]"
+
+// children alive at most at once : the others are launched as soon as some
+// terminate, which keeps far below the limits on the number of processes
+#define MAX_ALIVE 4096
+
+// rows of the table of the processes (-s), the histograms cover them all
+#define MAX_ROWS 32
+
+// tags of the descriptors watched by epoll, the timers use their core
+#define EV_SIGNAL -1
+
 // global variables
 
 volatile sig_atomic_t received = 0; // signal received
 
 // [child] 0: pending, 1: running
-// [parent] 0: nothing, 1: tick, 2: donned, 3: child terminated
 volatile sig_atomic_t status = 0;
 
+// [child] end of the quantum requested, kept apart from status since with
+// short quanta both signals may be delivered at once
+volatile sig_atomic_t stop = 0;
+
 // globals for child processes
 
-volatile sig_atomic_t count = 0; // number of quantum processed
+volatile sig_atomic_t count = 0;  // number of quantum processed
+volatile sig_atomic_t slices = 1; // length of the current run, in quanta
 volatile sig_atomic_t total = 0; // total number of quantum to process
 volatile int id = 0;             // id of the current process
+volatile uint64_t work = 0;      // result of the work done by the process
+struct doorbell_s *bell = NULL;  // control block of the process
 
-// globals for parent process
+eventlog_t *elog = NULL; // log of the events (-L), NULL to print them at once
 
-volatile sig_atomic_t term_count = 0; // number of terminated child processes
-volatile sig_atomic_t tick = 0;       // tick received
-volatile sig_atomic_t donned = 0;     // child process stopped successfully
-volatile sig_atomic_t term = 0;       // child process terminated
+/**
+ * @brief add a descriptor to the epoll instance of the environment
+ *
+ * @param env pointer to the environment
+ * @param fd descriptor to watch for reading
+ * @param tag what the descriptor is (EV_SIGNAL or a core)
+ */
+void env_watch(env_t *env, int fd, int tag) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    ev.data.fd = tag;
+    CHK(epoll_ctl(env->epfd, EPOLL_CTL_ADD, fd, &ev));
+}
 
 /**
- * @brief initialize the environment (process info and pids)
+ * @brief initialize the environment (process info) and the descriptors the
+ * parent waits on
  *
+ * @note SIGRTMIN and SIGCHLD must already be blocked, so that they are only
+ * received through the signalfd
  * @param env pointer to the environment
- * @param processes pointer to an array of process info
- * @param pids pointer to an array of pids
+ * @param qt quantum duration (in microseconds)
+ * @param tasks the processes, not launched yet
+ * @param bells their control blocks, in a shared mapping
  * @param nb_processes number of processes
+ * @param policies the queue of each core, owned by the environment now
+ * @param nb_cores number of cores
  */
-void env_init(env_t *env, long qt, pid_t *pids, int nb_processes) {
+void env_init(env_t *env, long qt, struct task_s *tasks,
+              struct doorbell_s *bells, int nb_processes, policy_t **policies,
+              int nb_cores) {
+    sigset_t mask;
+    cpu_set_t cpus;
+    int cpu_list[CPU_SETSIZE], nb_cpus = 0;
+
+    memset(env, 0, sizeof(*env));
     env->qt = qt;
-    env->pids = pids;
+    env->tasks = tasks;
+    env->bells = bells;
     env->nb_processes = nb_processes;
+    pidmap_init(&env->alive, nb_processes < MAX_ALIVE ? nb_processes
+                                                      : MAX_ALIVE);
+
+    CHK(env->epfd = epoll_create1(EPOLL_CLOEXEC));
+
+    CHK(sigemptyset(&mask));
+    CHK(sigaddset(&mask, SIGRTMIN));
+    CHK(sigaddset(&mask, SIGCHLD));
+    CHK(env->sfd = signalfd(-1, &mask, SFD_CLOEXEC));
+    env_watch(env, env->sfd, EV_SIGNAL);
+
+    // the cores take the cpus allowed in turn, several cores share a cpu if
+    // there are not enough of them
+    CHK(sched_getaffinity(0, sizeof(cpus), &cpus));
+    for (int i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, &cpus))
+            cpu_list[nb_cpus++] = i;
+
+    if ((env->cores = calloc(nb_cores, sizeof(struct core_s))) == NULL)
+        alert(0, "calloc");
+    env->nb_cores = nb_cores;
+    for (int c = 0; c < nb_cores; c++) {
+        struct core_s *core = &env->cores[c];
+
+        // a single core runs where the scheduler runs, as before
+        core->cpu = nb_cores > 1 ? cpu_list[c % nb_cpus] : -1;
+        core->policy = policies[c];
+        core->index = -1;
+        core->stopped = core->ticked = core->switch_from = -1;
+        CHK(core->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+        env_watch(env, core->tfd, c);
+    }
 }
 
 /**
- * @brief generic function to handle signals for the child processes
+ * @brief close the descriptors of the environment and free it
  *
- * @param sig signal number received
- * @note because of the way signals are received, we can't receive more than one
- * signal at a time so a single variable is used to store the signal
+ * @param env pointer to the environment
  */
-void child_sig_handler(int sig) {
-    received = 1;
-    switch (sig) {
-    case SIGUSR1:
-        status = 1; // [child] resume process
-        break;
-    case SIGUSR2:
-        status = 0; // [child] make the process stop
-        break;
+void env_destroy(env_t *env) {
+    CHK(close(env->sfd));
+    for (int c = 0; c < env->nb_cores; c++) {
+        CHK(close(env->cores[c].tfd));
+        policy_destroy(env->cores[c].policy);
     }
+    free(env->cores);
+    CHK(close(env->epfd));
+    pidmap_destroy(&env->alive);
 }
 
 /**
- * @brief generic function to handle signals for the parent processes
+ * @brief generic function to handle signals for the child processes
  *
  * @param sig signal number received
- * @note status is set to a non-zero value if we received a signal we want to
- * process, the actual signal(s) (because we could receive more than 1 at a time
- * trough the parent main loop) are recorded in some other global variables
+ * @param info SIGUSR1 comes with the number of quanta to run (sigqueue)
+ * @param ctx unused
+ * @note because of the way signals are received, we can't receive more than one
+ * signal at a time so a single variable is used to store the signal
  */
-void parent_sig_handler(int sig) {
+void child_sig_handler(int sig, siginfo_t *info, void *ctx) {
+    (void)ctx;
     received = 1;
     switch (sig) {
     case SIGUSR1:
-        status = 2; // [parent] record the pending process
-        donned = 1;
-        break;
-    case SIGALRM:
-        status = 1; // [parent] send the process running
-        tick = 1;
+        status = 1; // [child] resume process
+        slices = info->si_code == SI_QUEUE ? info->si_value.sival_int : 1;
         break;
-    case SIGCHLD:
-        status = 3; // [parent] record the terminated process(es)
-        term++;
+    case SIGUSR2:
+        stop = 1; // [child] make the process stop
         break;
     }
 }
@@ -130,10 +340,12 @@ void parent_sig_handler(int sig) {
  *
  * @param t total number of quantum to process
  * @param i id of the process (to print)
+ * @param b control block of the process
  */
-void child_on_startup(int t, int i) {
+void child_on_startup(int t, int i, struct doorbell_s *b) {
     total = t;
     id = i;
+    bell = b;
 }
 
 /**
@@ -146,15 +358,38 @@ void child_on_exit(void) {
 }
 
 /**
- * @brief sleep(1)
+ * @brief a slice of real work (xorshift rounds), about a microsecond
  *
- * @note this function has a major flow which is that we can receive a signal
- * just in between the sleep(1) call and the signal being blocked or unblocked
- * which will result in an additional sleep(1) call ;
- * we can resolve this by calling sleep with an arbitrary large value so that we
- * ever only sleep once, during which we "should" receive a signal properly
+ * @note the process works slice after slice until the end of its quantum,
+ * which is thus only late by a slice at most
  */
-void do_something(void) { sleep(1); }
+void do_something(void) {
+    uint64_t x = work | 1;
+
+    for (int i = 0; i < 512; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+    }
+    work = x * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * @brief report an event of a process : print it at once, or append it to the
+ * event log (-L), which is far cheaper than a line flushed to the terminal
+ *
+ * @param type EVENT_SURP, EVENT_EVIP or EVENT_TERM
+ * @param task index of the process
+ */
+void report_event(int type, int task) {
+    if (elog != NULL) {
+        eventlog_append(elog, type, task);
+        return;
+    }
+
+    fprintf(stdout, "%s - process %d\n", event_names[type], task);
+    fflush(stdout);
+}
 
 /**
  * @brief child process main loop
@@ -193,228 +428,791 @@ void child_main_loop(void) {
             break;
 
         case 1: // process running
-            count++;
-            fprintf(stdout, "SURP - process %d\n", id);
-            fflush(stdout);
-
-            if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
-                alert(1, "sigprocmask on mask block");
-
-            while (status == 1) {
-                if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-                    alert(1, "sigprocmask on mask unblock");
+            status = 0;
+            bell->running = now_ns();
+            count += slices;
+            report_event(EVENT_SURP, id);
+
+            // work until the end of the quantum (SIGUSR2) : only the handler
+            // sets stop, nothing needs to be blocked to check it
+            while (!stop)
                 do_something();
-                if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
-                    alert(1, "sigprocmask on mask block");
-            }
+            stop = 0;
 
-            if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-                alert(1, "sigprocmask on mask unblock");
-
-            CHK(kill(getppid(), SIGUSR1));
+            // a real-time signal is queued : with several cores, children
+            // stopping at once would make a single pending SIGUSR1
+            CHK(sigqueue(getppid(), SIGRTMIN,
+                         (union sigval){.sival_int = id}));
             break;
         }
     }
 }
 
 /**
- * @brief set the corresponding pid in the array to -1
+ * @brief child process main loop with the futex transport : no signal and no
+ * handler, the process sleeps on its doorbell and polls the stop word while
+ * it works
  *
- * @param pids array of pids
- * @param pid pid to set to 0
- * @param nb_p number of pids in the array
- * @return int - the index of the pid in the array or -1 if not found
  */
-int set_term(pid_t *pids, pid_t pid, int nb_p) {
-    for (int i = 0; i < nb_p; i++) {
-        if (pids[i] == pid) {
-            pids[i] = -1;
-            return i;
+void child_futex_loop(void) {
+    unsigned n;
+
+    while (count < total) {
+        // wait for the parent to ring
+        while ((n = atomic_exchange(&bell->run, 0)) == 0)
+            futex_wait(&bell->run, 0);
+
+        bell->running = now_ns();
+        count += n;
+        report_event(EVENT_SURP, id);
+
+        while (!atomic_load_explicit(&bell->stop, memory_order_relaxed))
+            do_something();
+        atomic_store(&bell->stop, 0);
+
+        atomic_store(&bell->done, 1);
+        futex_wake(&bell->done);
+    }
+}
+
+/**
+ * @brief start a quantum : let the child chosen for a core run and arm the
+ * timer of the core
+ *
+ * @param env the set of variables to work with
+ * @param core the core, with the index of the child and the length of the
+ * run, in quanta
+ */
+void quantum_start(env_t *env, struct core_s *core) {
+    struct itimerspec its;
+    int index = core->index;
+    struct usage_s *u = &env->usage[index];
+    union sigval value = {.sival_int = core->slices};
+    long us = env->qt * core->slices;
+
+    core->start = now_ns();
+    if (u->nb_runs++ == 0) {
+        u->response_ns = core->start - u->launched;
+        hist_record(&env->response, u->response_ns);
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = us / 1000000; // one shot
+    its.it_value.tv_nsec = us % 1000000 * 1000;
+
+    if (env->commands) {
+        // a command is resumed at once, with all its process group
+        report_event(EVENT_SURP, index);
+        env->bells[index].running = core->start;
+        CHK(killpg(env->tasks[index].pid, SIGCONT));
+    } else if (env->futex) {
+        struct doorbell_s *b = &env->bells[index];
+
+        atomic_store(&b->done, 0);
+        atomic_store(&b->run, core->slices);
+        futex_wake(&b->run);
+    } else
+        CHK(sigqueue(env->tasks[index].pid, SIGUSR1, value));
+    CHK(timerfd_settime(core->tfd, 0, &its, NULL));
+}
+
+/**
+ * @brief give a process to a core, pinning it to the cpu of the core if it
+ * comes from another one
+ *
+ * @param env the set of variables to work with
+ * @param k index of the process
+ * @param c the core
+ */
+void task_pin(env_t *env, int k, int c) {
+    cpu_set_t set;
+
+    if (env->cores[c].cpu != -1 && env->tasks[k].core != c) {
+        CPU_ZERO(&set);
+        CPU_SET(env->cores[c].cpu, &set);
+        CHK(sched_setaffinity(env->tasks[k].pid, sizeof(set), &set));
+    }
+    env->tasks[k].core = c;
+}
+
+/**
+ * @brief make a process ready on a core
+ *
+ * @param env the set of variables to work with
+ * @param k index of the process
+ * @param c the core
+ */
+void core_enqueue(env_t *env, int k, int c) {
+    struct core_s *core = &env->cores[c];
+
+    task_pin(env, k, c);
+    policy_enqueue(core->policy, k, env->tasks[k].remaining, 1);
+    core->nb_ready++;
+}
+
+/**
+ * @brief choose the next process of a core : from its own queue, or else
+ * stolen from the core with the most processes ready
+ *
+ * @param env the set of variables to work with
+ * @param c the core
+ * @param slices length of the run, in quanta
+ * @return int - index of the process, -1 if none is ready
+ */
+int core_dequeue(env_t *env, int c, long *slices) {
+    int victim = c, k;
+
+    if (env->cores[c].nb_ready == 0)
+        for (int v = 0; v < env->nb_cores; v++)
+            if (env->cores[v].nb_ready > env->cores[victim].nb_ready)
+                victim = v;
+
+    if ((k = policy_dequeue(env->cores[victim].policy, slices)) == -1)
+        return -1;
+    env->cores[victim].nb_ready--;
+
+    if (victim != c) {
+        env->nb_steals++;
+        task_pin(env, k, c);
+    }
+    return k;
+}
+
+/**
+ * @brief end a quantum : ask the running child to stop
+ *
+ * @param env the set of variables to work with
+ * @param index index of the running child
+ * @return int - 1 if the child has stopped already (futex transport or
+ * command), 0 if it will send SIGRTMIN once stopped
+ */
+int quantum_stop(env_t *env, int index) {
+    struct doorbell_s *b = &env->bells[index];
+
+    if (env->commands) {
+        CHK(killpg(env->tasks[index].pid, SIGSTOP));
+        return 1;
+    }
+
+    if (!env->futex) {
+        CHK(kill(env->tasks[index].pid, SIGUSR2));
+        return 0;
+    }
+
+    // the child stops within a slice of work
+    atomic_store(&b->stop, 1);
+    while (atomic_load(&b->done) == 0)
+        futex_wait(&b->done, 0);
+    return 1;
+}
+
+/**
+ * @brief print the statistics of the run on stderr : throughput, turnaround,
+ * utilization of the cores, overhead and latency of the switches and
+ * percentiles of the jitter of the quanta
+ *
+ * @param env the set of variables to work with
+ */
+void print_stats(env_t *env) {
+    uint64_t n = env->jitter.nb;
+    double elapsed = (now_ns() - env->t0) / 1e9;
+
+    if (!env->stats || n == 0)
+        return;
+
+    fprintf(stderr,
+            "policy %s: %ld quanta in %.3f s (%.1f quanta/s), turnaround "
+            "mean %.3f s max %.3f s\n",
+            env->cores[0].policy->ops->name, env->nb_quanta, elapsed,
+            env->nb_quanta / elapsed,
+            env->turnaround_sum / 1e9 / env->nb_processes,
+            env->turnaround_max / 1e9);
+
+    // the time the processes ran is about the makespan on a single core, the
+    // ratio is the parallelism reached (if the cores have their own cpu)
+    if (env->nb_cores > 1) {
+        int64_t busy = 0;
+
+        for (int c = 0; c < env->nb_cores; c++) {
+            struct core_s *core = &env->cores[c];
+
+            fprintf(stderr, "core %d (cpu %d): %ld quanta, utilization %.1f%%\n",
+                    c, core->cpu, core->nb_quanta,
+                    core->busy_ns / 1e7 / elapsed);
+            busy += core->busy_ns;
         }
+        fprintf(stderr,
+                "makespan %.3f s on %d cores, %ld steals, parallelism %.2f "
+                "(busy time / makespan)\n",
+                elapsed, env->nb_cores, env->nb_steals, busy / 1e9 / elapsed);
+    }
+
+    // the cpu time of the parent, but forking, is the cost of the switches
+    if (env->nb_switches > 0)
+        fprintf(stderr,
+                "%ld switches, overhead per switch %.2f us (parent cpu "
+                "%.2f us)\n",
+                env->nb_switches, env->switch_ns / 1e3 / env->nb_switches,
+                (cpu_ns() - env->cpu0 - env->launch_cpu) / 1e3 /
+                    env->nb_switches);
+
+    // from the end of a quantum to the next process running
+    if (env->latency.nb > 0) {
+        fprintf(stderr,
+                "transport %s, switch latency over %" PRIu64 " switches (us):",
+                env->futex ? "futex" : "signal", env->latency.nb);
+        hist_print_line(&env->latency, stderr, 1e3);
+    }
+
+    fprintf(stderr, "quantum %ld us, jitter over %" PRIu64 " runs (us):",
+            env->qt, n);
+    hist_print_line(&env->jitter, stderr, 1e3);
+}
+
+/**
+ * @brief the process running on a core stopped : it goes back to the ready
+ * processes of the core, unless it is done
+ *
+ * @param env the set of variables to work with
+ * @param core the core
+ * @param exited 1 if the process is a command which ended during its quantum
+ */
+void core_stopped(env_t *env, struct core_s *core, int exited) {
+    int index = core->index;
+    struct usage_s *u = &env->usage[index];
+
+    core->stopped = now_ns();
+    core->launch_ns = env->launch_ns;
+    core->busy_ns += core->stopped - core->start;
+    core->nb_quanta += core->slices;
+    u->run_ns += core->stopped - core->start;
+    if (exited) {
+        core->index = -1;
+        return;
+    }
+
+    // a few instructions each, recorded even without -s
+    hist_record(&env->jitter,
+                core->stopped - core->start - env->qt * core->slices * 1000);
+    if (core->switch_from != -1)
+        hist_record(&env->latency,
+                    env->bells[index].running - core->switch_from);
+    // the parent resumes a command itself, the delay is not known
+    if (!env->commands) {
+        u->delivery_ns += env->bells[index].running - core->start;
+        hist_record(&env->delivery, env->bells[index].running - core->start);
     }
-    return -1;
+    report_event(EVENT_EVIP, index);
+
+    // a command runs until it ends
+    env->nb_quanta += core->slices;
+    if (env->commands || (env->tasks[index].remaining -= core->slices) > 0) {
+        u->nb_preempted++;
+        core_enqueue(env, index, core - env->cores);
+    }
+    core->index = -1; // only reset here to send a process running
 }
 
 /**
- * @brief parent process main loop
+ * @brief print on stderr what each process went through : its quanta and the
+ * runs stopped before its end, its response time (from its fork to its first
+ * run), the time it was ready but waited for a core, its cpu time (wait4), its
+ * wall time and the mean delay of the transport to start its runs; then the
+ * percentiles of these delays over all the processes
+ *
+ * @note only the first MAX_ROWS processes get a row, the stress mode (-S)
+ * would print tens of thousands of them
  *
  * @param env the set of variables to work with
  */
-void parent_main_loop(env_t *env) {
-    int qt = (int)env->qt;
-    pid_t *pids = env->pids;
-    pid_t pid;
-    int exit_status, exit_code;
-    int count;
-    int k;
-    int nb_p = env->nb_processes;
+void print_usage(env_t *env) {
+    fprintf(stderr, "%-8s %6s %6s %7s %13s %10s %10s %10s %13s%s\n",
+            "process", "status", "runs", "preempt", "response (ms)",
+            "wait (ms)", "cpu (ms)", "wall (ms)", "delivery (us)",
+            env->commands ? "  command" : "");
+    for (int k = 0; k < env->nb_processes && k < MAX_ROWS; k++) {
+        struct usage_s *u = &env->usage[k];
+
+        fprintf(stderr, "%-8d %6d %6d %7d %13.3f %10.3f %10.3f %10.3f ", k,
+                u->status, u->nb_runs, u->nb_preempted, u->response_ns / 1e6,
+                (u->wall_ns - u->run_ns) / 1e6, u->cpu_ns / 1e6,
+                u->wall_ns / 1e6);
+        if (env->commands)
+            fprintf(stderr, "%13s  %s\n", "-", env->commands[k]);
+        else
+            fprintf(stderr, "%13.1f\n",
+                    u->nb_runs ? u->delivery_ns / 1e3 / u->nb_runs : 0);
+    }
+    if (env->nb_processes > MAX_ROWS)
+        fprintf(stderr, "... %d more processes\n",
+                env->nb_processes - MAX_ROWS);
+
+    hist_print(&env->response, stderr, "response time (ms)", 1e6);
+    hist_print(&env->waiting, stderr, "waiting time (ms)", 1e6);
+    hist_print(&env->delivery, stderr,
+               env->futex ? "doorbell delivery (us)" : "signal delivery (us)",
+               1e3);
+}
 
-    sigset_t mask, empty;
+/**
+ * @brief in the child, run a command in its own process group, stopped until
+ * its first quantum
+ *
+ * @param cmd the command line, run by sh
+ */
+noreturn void command_exec(const char *cmd) {
+    sigset_t empty;
+
+    // the command gets the signals the scheduler blocked
     CHK(sigemptyset(&empty));
-    CHK(sigemptyset(&mask));
-    CHK(sigaddset(&mask, SIGALRM));
-    CHK(sigaddset(&mask, SIGUSR1));
-    CHK(sigaddset(&mask, SIGCHLD));
+    CHK(sigprocmask(SIG_SETMASK, &empty, NULL));
+    CHK(setpgid(0, 0));
+    CHK(raise(SIGSTOP));
 
-    int index = 0;
-    while (term_count < nb_p) {
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    alert(1, "exec %s", cmd);
+}
 
-        if (status == 0) {
-            // send a process running
-            CHK(kill(pids[index], SIGUSR1));
-            alarm(qt);
-        }
+/**
+ * @brief fork a process, which waits for its first quantum, and make it
+ * ready
+ *
+ * @param env the set of variables to work with
+ * @param k index of the process
+ */
+void task_launch(env_t *env, int k) {
+    int64_t start = now_ns(), cpu = cpu_ns();
+    int st;
+    pid_t pid;
 
-        // block signals
-        if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
-            alert(1, "sigprocmask on mask block");
+    switch (pid = fork()) {
+    case -1:
+        alert(1, "pid = fork()");
+
+    case 0:
+        if (env->commands)
+            command_exec(env->commands[k]);
+
+        // child process init
+        child_on_startup(env->tasks[k].remaining, k, &env->bells[k]);
+        int futex = env->futex;
+        free(env->tasks);
+        env_destroy(env);
+        if (futex)
+            child_futex_loop(); // child process main loop
+        else
+            child_main_loop();
+        child_on_exit(); // child process exit
+        exit(EXIT_SUCCESS);
+    }
 
-        // wait for signal
-        if (!received) {
-            sigsuspend(&empty);
-            if (errno != EINTR)
-                alert(1, "sigsuspend");
-        }
+    // a command must be stopped before it may be resumed
+    if (env->commands) {
+        CHK(waitpid(pid, &st, WUNTRACED));
+        if (!WIFSTOPPED(st))
+            alert(0, "command %d did not start: %s", k, env->commands[k]);
+    }
+    env->usage[k].launched = start;
 
-        // unblock signals
-        if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-            alert(1, "sigprocmask on mask unblock");
+    // the cores get the new processes in turn
+    env->tasks[k].pid = pid;
+    env->tasks[k].core = -1;
+    pidmap_put(&env->alive, pid, k);
+    core_enqueue(env, k, k % env->nb_cores);
 
-        received = 0;
+    env->launch_ns += now_ns() - start;
+    env->launch_cpu += cpu_ns() - cpu;
+}
 
-        // process the signal
-        if (status == 0)
+/**
+ * @brief collect the terminated children (SIGCHLD was received)
+ *
+ * @param env the set of variables to work with
+ * @return int - the number of children collected
+ */
+int children_terminated(env_t *env) {
+    int exit_status, exit_code, k, nb = 0;
+    struct rusage ru;
+    struct core_s *core;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &exit_status, WNOHANG, &ru)) > 0) {
+        if ((k = pidmap_take(&env->alive, pid)) == -1)
+            alert(0, "unknown child process %jd", (intmax_t)pid);
+        env->tasks[k].pid = -1;
+        nb++;
+
+        // a command may end during its quantum, which frees its core
+        core = &env->cores[env->tasks[k].core];
+        if (env->commands && core->index == k)
+            core_stopped(env, core, 1);
+        struct usage_s *u = &env->usage[k];
+
+        u->wall_ns = now_ns() - u->launched;
+        u->cpu_ns = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ll +
+                    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ll;
+        u->status = WIFEXITED(exit_status) ? WEXITSTATUS(exit_status)
+                                           : 128 + WTERMSIG(exit_status);
+        hist_record(&env->waiting, u->wall_ns - u->run_ns);
+
+        int64_t turnaround = now_ns() - env->t0;
+        env->turnaround_sum += turnaround;
+        if (turnaround > env->turnaround_max)
+            env->turnaround_max = turnaround;
+
+        // the process has terminated
+        report_event(EVENT_TERM, k);
+
+        // check the exit code of the process, a command may fail
+        if (!env->commands && WIFEXITED(exit_status) &&
+            (exit_code = WEXITSTATUS(exit_status)) != EXIT_SUCCESS)
+            alert(0, "child process %jd exited with status %d\n",
+                  (intmax_t)pid, exit_code);
+    }
+    if (pid == -1 && errno != ECHILD)
+        alert(1, "wait4");
+
+    return nb;
+}
+
+/**
+ * @brief send the next process running on an idle core
+ *
+ * @param env the set of variables to work with
+ * @param core the core
+ */
+void core_dispatch(env_t *env, struct core_s *core) {
+    int c = core - env->cores;
+
+    if ((core->index = core_dequeue(env, c, &core->slices)) == -1)
+        return;
+
+    if (core->slices > env->tasks[core->index].remaining)
+        core->slices = env->tasks[core->index].remaining;
+    quantum_start(env, core);
+
+    if (core->stopped != -1) {
+        env->switch_ns +=
+            core->start - core->stopped - (env->launch_ns - core->launch_ns);
+        env->nb_switches++;
+        core->stopped = -1;
+    }
+    core->switch_from = core->ticked;
+    core->ticked = -1;
+}
+
+/**
+ * @brief parent process main loop
+ *
+ * A single epoll_wait() waits for everything : the end of the quantum of
+ * each core (its timerfd), a running child stopping (SIGRTMIN) and the
+ * termination of children (SIGCHLD), both through the signalfd. What became
+ * ready is then handled in the order of the protocol : ticks, stops,
+ * terminations. With the futex transport, a child has stopped as soon as its
+ * tick is handled.
+ *
+ * @param env the set of variables to work with
+ */
+void parent_main_loop(env_t *env) {
+    struct epoll_event evs[64];
+    struct signalfd_siginfo si[8];
+    uint64_t expirations;
+    ssize_t nb;
+    int nb_p = env->nb_processes;
+    int term_count = 0; // number of terminated child processes
+
+    env->t0 = now_ns();
+    env->cpu0 = cpu_ns();
+
+    while (term_count < nb_p) {
+
+        // launch processes while there is room for them
+        while (env->nb_launched < nb_p &&
+               env->nb_launched - term_count < MAX_ALIVE)
+            task_launch(env, env->nb_launched++);
+
+        // send processes running on the idle cores
+        for (int c = 0; c < env->nb_cores; c++)
+            if (env->cores[c].index == -1)
+                core_dispatch(env, &env->cores[c]);
+
+        int n = epoll_wait(env->epfd, evs, 64, -1);
+        if (n == -1 && errno == EINTR)
             continue;
+        CHK(n);
+
+        int reap = 0;
+        for (int i = 0; i < n; i++) {
+            struct core_s *core;
+            int k;
+
+            if (evs[i].data.fd != EV_SIGNAL) {
+                core = &env->cores[evs[i].data.fd];
+                CHK(read(core->tfd, &expirations, sizeof(expirations)));
+                core->tick = core->index != -1;
+                continue;
+            }
 
-        // SIGALRM
-        if (tick) {
-            CHK(kill(pids[index], SIGUSR2));
-            tick = 0;
+            CHK(nb = read(env->sfd, si, sizeof(si)));
+            for (size_t j = 0; j < nb / sizeof(si[0]); j++) {
+                if (si[j].ssi_signo == SIGCHLD) {
+                    reap = 1;
+                    continue;
+                }
+                // only a running child may signal the end of its quantum
+                k = pidmap_get(&env->alive, si[j].ssi_pid);
+                if (k != -1 && env->cores[env->tasks[k].core].index == k)
+                    env->cores[env->tasks[k].core].donned = 1;
+            }
         }
 
-        // SIGUSR1
-        if (donned) {
-            fprintf(stdout, "EVIP - process %d\n", index);
-            fflush(stdout);
-
-            // choose the next process to run
-            count = 0;
-            do {
-                count++;
-                index = (index + 1) % nb_p;
-            } while (pids[index] == -1 && count < nb_p);
-            donned = 0;
-            status = 0; // only reset here to send a process running
-        }
+        for (int c = 0; c < env->nb_cores; c++) {
+            struct core_s *core = &env->cores[c];
 
-        // SIGCHLD
-        while (term) {
-            CHK((pid = wait(&exit_status)));
-            k = set_term(pids, pid, nb_p);
-            if (k == -1)
-                alert(0, "pid not found");
-
-            // the process has terminated
-            term_count++;
-            fprintf(stdout, "TERM - process %d\n", k);
-            fflush(stdout);
-
-            // check the exit code of the process
-            if (WIFEXITED(exit_status) &&
-                (exit_code = WEXITSTATUS(exit_status)) != EXIT_SUCCESS)
-                alert(0, "child process %jd exited with status %d\n",
-                      (intmax_t)pid, exit_code);
-
-            term--; // terminate one process at a time if needed
+            // end of the quantum
+            if (core->tick) {
+                core->ticked = now_ns();
+                core->donned |= quantum_stop(env, core->index);
+            }
+
+            // the running child stopped
+            if (core->donned)
+                core_stopped(env, core, 0);
+            core->tick = core->donned = 0;
         }
+
+        // children terminated
+        if (reap)
+            term_count += children_terminated(env);
     }
 }
 
+/**
+ * @brief parse a duration : seconds, or microseconds, milliseconds or seconds
+ * with the unit "us", "ms" or "s"
+ *
+ * @param str the duration
+ * @return long - the duration in microseconds, -1 if it is invalid
+ */
+long parse_quantum(const char *str) {
+    char *endptr;
+    long t = strtol(str, &endptr, 10), unit;
+
+    if (endptr == str || t <= 0)
+        return -1;
+
+    if (strcmp(endptr, "us") == 0)
+        unit = 1;
+    else if (strcmp(endptr, "ms") == 0)
+        unit = 1000;
+    else if (strcmp(endptr, "s") == 0 || *endptr == '\0')
+        unit = 1000000;
+    else
+        return -1;
+
+    return t > LONG_MAX / unit ? -1 : t * unit;
+}
+
 int main(int argc, char *argv[]) {
-    // usage: ./ordonnanceur <quantum in seconds> <number of quantum> <...>
+    // usage: ./ordonnanceur [-p policy] [-t signal|futex] [-c cores] [-s]
+    //                       [-S tasks] <quantum> <number of quantum>
 
-    pid_t pid;
-    int n = argc - 2;
     char *endptr;
+    int stats = 0;
+    int stress = 0; // number of processes of the stress mode (-S), 0 if none
+    int futex = 0;  // transport (-t)
+    int nb_cores = 1; // processes running at once (-c)
+    int exec = 0;     // the operands are commands (-x)
+    const char *trace = NULL; // simulation of the tasks of a trace
+    int log = -1;     // format of the event log (-L), -1 to print at once
+    const char *policy = "rr";
+    int opt;
+
+    static const struct option longopts[] = {
+        {"simulate", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0},
+    };
+
+    // options stop at the first operand, which may be negative
+    while ((opt = getopt_long(argc, argv, "+p:t:c:sS:xL:", longopts, NULL)) !=
+           -1) {
+        switch (opt) {
+        case 'p':
+            policy = optarg;
+            break;
+        case 't':
+            if (strcmp(optarg, "futex") == 0)
+                futex = 1;
+            else if (strcmp(optarg, "signal") != 0)
+                alert(0, "bad transport: %s (signal or futex)", optarg);
+            break;
+        case 'c':
+            nb_cores = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr != '\0' || nb_cores <= 0 ||
+                nb_cores > CPU_SETSIZE)
+                alert(0, "bad number of cores: %s", optarg);
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 'S':
+            stress = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr != '\0' || stress <= 0)
+                alert(0, "bad number of tasks: %s", optarg);
+            stats = 1;
+            break;
+        case 'x':
+            exec = 1;
+            break;
+        case 'm':
+            trace = optarg;
+            break;
+        case 'L':
+            if ((log = strcmp(optarg, "json") == 0) == 0 &&
+                strcmp(optarg, "text") != 0)
+                alert(0, "bad event log format: %s (text or json)", optarg);
+            break;
+        default:
+            alert(0, USAGE, argv[0], argv[0], argv[0]);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // no process at all, a single virtual cpu
+    if (trace != NULL) {
+        if (argc > 1 || exec || stress || futex || nb_cores > 1 || log != -1)
+            alert(0, USAGE, argv[0], argv[0], argv[0]);
+        simulate(trace, policy, stats);
+        return 0;
+    }
+
+    // the stress mode repeats the durations given (1 quantum by default)
+    int nb_t = argc - 2;
+    int n = stress ? stress : nb_t;
 
     // check number of arguments
-    if (n <= 0)
-        alert(0, "usage: %s <t> t0 [t1] [t2] ...", argv[0]);
+    if (argc < 2 || n <= 0 || (exec && nb_t <= 0))
+        alert(0, USAGE, argv[0], argv[0], argv[0]);
+    if (exec && futex)
+        alert(0, "commands are stopped with signals, not futex");
 
     // check for values
-    long t = strtol(argv[1], &endptr, 10);
-    if (endptr == argv[1] || *endptr != '\0' || t <= 0)
+    long t = parse_quantum(argv[1]);
+    if (t == -1)
         alert(0, "bad quantum value: %s", argv[1]);
 
-    // array that holds each process time to be used in the scheduler
-    long *t_array = malloc(sizeof(long) * n);
-    if (t_array == NULL)
-        alert(0, "malloc");
-
-    // array that holds each process pid
-    pid_t *pid_array = malloc(sizeof(pid_t) * n);
-    if (pid_array == NULL)
-        alert(0, "malloc");
+    // array that holds each process, its pid and the quanta it has to run
+    struct task_s *tasks = calloc(n, sizeof(struct task_s));
+    if (tasks == NULL)
+        alert(0, "calloc");
 
-    // check for values
-    for (int i = 2; i < argc; i++) {
+    // check for values, a command runs as many quanta as it needs
+    long max_quanta = 0;
+    for (int i = 2; i < argc && !exec; i++) {
         long ti = strtol(argv[i], &endptr, 10);
-        if (endptr == argv[i] || *endptr != '\0' || ti <= 0) {
-            free(t_array);
-            free(pid_array);
+        if (endptr == argv[i] || *endptr != '\0' || ti <= 0 || ti > INT_MAX) {
+            free(tasks);
             alert(0, "bad format or value for t%d : %s", i - 2, argv[i]);
         }
-        t_array[i - 2] = ti;
+        if (ti > max_quanta)
+            max_quanta = ti;
+    }
+    for (int i = 0; i < n; i++)
+        tasks[i].remaining =
+            nb_t && !exec ? strtol(argv[2 + i % nb_t], NULL, 10) : 1;
+    if (nb_t == 0 || exec)
+        max_quanta = 1;
+
+    // the events of the processes : SURP and EVIP for each run, and TERM
+    if (log != -1) {
+        size_t nb_events = exec ? 1 << 20 : n;
+        for (int i = 0; i < n && !exec; i++)
+            nb_events += 2 * (size_t)tasks[i].remaining;
+        elog = eventlog_create(nb_events < 1 << 24 ? nb_events : 1 << 24);
+    }
+
+    // the commands, and what the parent measures of each process
+    char **commands = NULL;
+    if (exec) {
+        if ((commands = malloc(sizeof(char *) * n)) == NULL)
+            alert(0, "malloc");
+        for (int i = 0; i < n; i++)
+            commands[i] = argv[2 + i % nb_t];
+    }
+    struct usage_s *usage = calloc(n, sizeof(struct usage_s));
+    if (usage == NULL)
+        alert(0, "calloc");
+
+    // a queue for each core
+    policy_t **pols = malloc(sizeof(policy_t *) * nb_cores);
+    if (pols == NULL)
+        alert(0, "malloc");
+    for (int c = 0; c < nb_cores; c++) {
+        if ((pols[c] = policy_create(policy, n, max_quanta, getpid() + c)) ==
+            NULL) {
+            free(pols);
+            free(tasks);
+            alert(0, "bad policy: %s (%s)", policy, policy_names);
+        }
     }
 
     // initialize the signal handler for the child processes
     struct sigaction act;
-    act.sa_handler = child_sig_handler;
-    act.sa_flags = 0;
+    act.sa_sigaction = child_sig_handler;
+    act.sa_flags = SA_SIGINFO;
     CHK(sigemptyset(&act.sa_mask));
     CHK(sigaction(SIGUSR1, &act, NULL));
     CHK(sigaction(SIGUSR2, &act, NULL));
 
-    // launch the child processes
-    for (int i = 0; i < n; i++) {
-        switch ((pid = fork())) {
+    // the commands stopped at the end of their quanta need no SIGCHLD
+    act.sa_handler = SIG_DFL;
+    act.sa_flags = SA_NOCLDSTOP;
+    CHK(sigaction(SIGCHLD, &act, NULL));
 
-        case -1:
-            alert(1, "pid = fork()");
+    // the parent receives SIGRTMIN and SIGCHLD through a signalfd only, the
+    // children unblock SIGUSR1 themselves
+    sigset_t mask;
+    CHK(sigemptyset(&mask));
+    CHK(sigaddset(&mask, SIGUSR1));
+    CHK(sigaddset(&mask, SIGRTMIN));
+    CHK(sigaddset(&mask, SIGCHLD));
+    CHK(sigprocmask(SIG_BLOCK, &mask, NULL));
 
-        case 0:
-            child_on_startup(t_array[i], i); // child process init
-            child_main_loop();               // child process main loop
-            child_on_exit();                 // child process exit
-            free(t_array);
-            free(pid_array);
-            exit(EXIT_SUCCESS);
-
-        default:
-            pid_array[i] = pid;
-            break;
-        }
-    }
+    // control blocks of the processes, inherited by the children
+    struct doorbell_s *bells =
+        mmap(NULL, n * sizeof(struct doorbell_s), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (bells == MAP_FAILED)
+        alert(1, "mmap");
 
     // initialize the environment
     env_t env; // environment for the parent process
-    env_init(&env, t, pid_array, n);
-    free(t_array); // we should not use that anymore
-    t_array = NULL;
-
-    // modify the signal handler for the parent process
-    act.sa_handler = parent_sig_handler;
-    CHK(sigaction(SIGUSR1, &act, NULL));
-    CHK(sigaction(SIGCHLD, &act, NULL));
-    CHK(sigaction(SIGALRM, &act, NULL));
-
-    // interract with child processes
+    env_init(&env, t, tasks, bells, n, pols, nb_cores);
+    env.stats = stats;
+    env.futex = futex;
+    env.commands = commands;
+    env.usage = usage;
+    free(pols); // the environment owns the policies
+
+    // launch the child processes and interract with them
     parent_main_loop(&env);
+    if (elog != NULL) {
+        eventlog_decode(elog, stdout, log);
+        eventlog_destroy(elog);
+    }
+    print_stats(&env);
+    if (stats)
+        print_usage(&env);
+    env_destroy(&env);
+    CHK(munmap(bells, n * sizeof(struct doorbell_s)));
 
     // we already registered terminated processes with wait in the parent main
-    // loop so we can just exit and free the remaining pid array (once)
+    // loop so we can just exit and free the tasks
 
     // free
-    free(pid_array);
+    free(commands);
+    free(usage);
+    free(tasks);
     return 0;
 }
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pidmap.h"
+
+static size_t pidmap_hash(const pidmap_t *m, pid_t pid) {
+    uint32_t h = (uint32_t)pid * 2654435761u; // Knuth's multiplicative hash
+
+    return (h ^ h >> 16) & m->mask;
+}
+
+void pidmap_init(pidmap_t *m, size_t capacity) {
+    size_t size = 16;
+
+    // at most half full, so that the probe sequences stay short
+    while (size < 2 * capacity)
+        size *= 2;
+    if ((m->slots = calloc(size, sizeof(struct pidmap_slot_s))) == NULL)
+        alert(0, "calloc");
+    m->mask = size - 1;
+}
+
+void pidmap_destroy(pidmap_t *m) { free(m->slots); }
+
+void pidmap_put(pidmap_t *m, pid_t pid, int index) {
+    size_t i = pidmap_hash(m, pid);
+
+    while (m->slots[i].pid != 0)
+        i = (i + 1) & m->mask;
+    m->slots[i].pid = pid;
+    m->slots[i].index = index;
+}
+
+int pidmap_get(const pidmap_t *m, pid_t pid) {
+    size_t i = pidmap_hash(m, pid);
+
+    for (; m->slots[i].pid != pid; i = (i + 1) & m->mask)
+        if (m->slots[i].pid == 0)
+            return -1;
+    return m->slots[i].index;
+}
+
+int pidmap_take(pidmap_t *m, pid_t pid) {
+    size_t i = pidmap_hash(m, pid), j, home;
+    int index;
+
+    while (m->slots[i].pid != pid) {
+        if (m->slots[i].pid == 0)
+            return -1;
+        i = (i + 1) & m->mask;
+    }
+    index = m->slots[i].index;
+    m->slots[i].pid = 0;
+
+    // shift back the following slots of the run which may now be found
+    // earlier, instead of leaving a tombstone
+    for (j = (i + 1) & m->mask; m->slots[j].pid != 0; j = (j + 1) & m->mask) {
+        home = pidmap_hash(m, m->slots[j].pid);
+        if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+            m->slots[i] = m->slots[j];
+            m->slots[j].pid = 0;
+            i = j;
+        }
+    }
+
+    return index;
+}
@@ -0,0 +1,39 @@
+#ifndef PIDMAP_H
+#define PIDMAP_H
+
+/*
+ * Index of the children of the ordonnanceur by pid : an open addressing hash
+ * table with linear probing, so that finding which task a terminated child
+ * was costs O(1) whatever the number of tasks.
+ */
+
+#include <stddef.h>
+#include <stdnoreturn.h>
+#include <sys/types.h>
+
+// print an error message (and errno if syserr == 1) then exit(1)
+noreturn void alert(int syserr, const char *msg, ...);
+
+/// a slot of the table
+struct pidmap_slot_s {
+    pid_t pid; // 0 if the slot is empty
+    int index; // index of the task
+};
+
+/// the table
+struct pidmap_s {
+    struct pidmap_slot_s *slots;
+    size_t mask; // number of slots - 1, a power of 2
+};
+typedef struct pidmap_s pidmap_t;
+
+// table for capacity pids at most at once
+void pidmap_init(pidmap_t *m, size_t capacity);
+void pidmap_destroy(pidmap_t *m);
+void pidmap_put(pidmap_t *m, pid_t pid, int index);
+// index of a pid, -1 if it is not in the table
+int pidmap_get(const pidmap_t *m, pid_t pid);
+// remove a pid from the table, return its index (-1 if it is not there)
+int pidmap_take(pidmap_t *m, pid_t pid);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+
+const char *policy_names = "rr, mlfq, lottery or srq";
+
+static void *xcalloc(size_t nb, size_t size) {
+    void *p = calloc(nb, size);
+
+    if (p == NULL)
+        alert(0, "calloc");
+    return p;
+}
+
+/*
+ * intrusive FIFO lists of tasks : next[task] is the task after it, so that
+ * a task is in one list at most and no list needs any allocation
+ */
+
+/// a FIFO list of tasks
+struct fifo_s {
+    int head, tail; // -1 if empty
+};
+
+static void fifo_init(struct fifo_s *f) { f->head = f->tail = -1; }
+
+static void fifo_push(struct fifo_s *f, int *next, int task) {
+    next[task] = -1;
+    if (f->tail == -1)
+        f->head = task;
+    else
+        next[f->tail] = task;
+    f->tail = task;
+}
+
+static int fifo_pop(struct fifo_s *f, int *next) {
+    int task = f->head;
+
+    if (task != -1 && (f->head = next[task]) == -1)
+        f->tail = -1;
+    return task;
+}
+
+/// append the list g to the list f, emptying g
+static void fifo_concat(struct fifo_s *f, struct fifo_s *g, int *next) {
+    if (g->head == -1)
+        return;
+    if (f->tail == -1)
+        f->head = g->head;
+    else
+        next[f->tail] = g->head;
+    f->tail = g->tail;
+    fifo_init(g);
+}
+
+/*
+ * round robin
+ */
+
+struct rr_s {
+    struct fifo_s ready;
+    int *next;
+};
+
+static void *rr_create(int nb_tasks, long max_quanta, unsigned seed) {
+    struct rr_s *rr = xcalloc(1, sizeof(struct rr_s));
+
+    (void)max_quanta;
+    (void)seed;
+    fifo_init(&rr->ready);
+    rr->next = xcalloc(nb_tasks, sizeof(int));
+    return rr;
+}
+
+static void rr_destroy(void *state) {
+    struct rr_s *rr = state;
+
+    free(rr->next);
+    free(rr);
+}
+
+static void rr_enqueue(void *state, int task, long remaining, int priority) {
+    struct rr_s *rr = state;
+
+    (void)remaining;
+    (void)priority;
+    fifo_push(&rr->ready, rr->next, task);
+}
+
+static int rr_dequeue(void *state, long *slices) {
+    struct rr_s *rr = state;
+
+    *slices = 1;
+    return fifo_pop(&rr->ready, rr->next);
+}
+
+/*
+ * multilevel feedback queue
+ *
+ * The boost moves every list to the top level at once. The level of a task
+ * which was not in a list then (the running one) is reset when it comes back,
+ * as it belongs to an older epoch.
+ */
+
+#define LEVELS 4
+#define BOOST 64 // quanta between two boosts
+
+struct mlfq_s {
+    struct fifo_s levels[LEVELS];
+    unsigned nonempty; // bit l set if levels[l] is not empty
+    int *next;
+    unsigned char *level; // level of each task when it is enqueued again
+    unsigned *epoch;      // epoch of the level of each task
+    unsigned cur_epoch;
+    long picks; // quanta since the last boost
+};
+
+static void *mlfq_create(int nb_tasks, long max_quanta, unsigned seed) {
+    struct mlfq_s *q = xcalloc(1, sizeof(struct mlfq_s));
+
+    (void)max_quanta;
+    (void)seed;
+    for (int l = 0; l < LEVELS; l++)
+        fifo_init(&q->levels[l]);
+    q->next = xcalloc(nb_tasks, sizeof(int));
+    q->level = xcalloc(nb_tasks, sizeof(unsigned char));
+    q->epoch = xcalloc(nb_tasks, sizeof(unsigned));
+    return q;
+}
+
+static void mlfq_destroy(void *state) {
+    struct mlfq_s *q = state;
+
+    free(q->next);
+    free(q->level);
+    free(q->epoch);
+    free(q);
+}
+
+static void mlfq_enqueue(void *state, int task, long remaining,
+                         int priority) {
+    struct mlfq_s *q = state;
+    int l = q->epoch[task] == q->cur_epoch ? q->level[task] : 0;
+
+    (void)remaining;
+    (void)priority;
+    fifo_push(&q->levels[l], q->next, task);
+    q->nonempty |= 1u << l;
+}
+
+static int mlfq_dequeue(void *state, long *slices) {
+    struct mlfq_s *q = state;
+    int l, task;
+
+    if (++q->picks >= BOOST) {
+        for (l = 1; l < LEVELS; l++)
+            fifo_concat(&q->levels[0], &q->levels[l], q->next);
+        q->nonempty = q->nonempty ? 1 : 0;
+        q->cur_epoch++;
+        q->picks = 0;
+    }
+
+    if (q->nonempty == 0)
+        return -1;
+
+    l = __builtin_ctz(q->nonempty);
+    task = fifo_pop(&q->levels[l], q->next);
+    if (q->levels[l].head == -1)
+        q->nonempty &= ~(1u << l);
+
+    // the task uses its whole quantum, it comes back one level lower
+    *slices = 1l << l;
+    q->level[task] = l + 1 < LEVELS ? l + 1 : l;
+    q->epoch[task] = q->cur_epoch;
+    return task;
+}
+
+/*
+ * lottery
+ *
+ * The ready tasks are kept in one array per priority, a task of priority p
+ * holding p tickets : the draw picks an array weighted by its tickets, then a
+ * task of the array uniformly.
+ */
+
+struct lottery_s {
+    int *tasks[TICKETS_MAX]; // ready tasks of each priority
+    int nb[TICKETS_MAX];
+    uint64_t rng; // xorshift64 state
+};
+
+static void *lottery_create(int nb_tasks, long max_quanta, unsigned seed) {
+    struct lottery_s *q = xcalloc(1, sizeof(struct lottery_s));
+
+    (void)max_quanta;
+    for (int p = 0; p < TICKETS_MAX; p++)
+        q->tasks[p] = xcalloc(nb_tasks, sizeof(int));
+    q->rng = 0x9e3779b97f4a7c15ull ^ seed;
+    return q;
+}
+
+static void lottery_destroy(void *state) {
+    struct lottery_s *q = state;
+
+    for (int p = 0; p < TICKETS_MAX; p++)
+        free(q->tasks[p]);
+    free(q);
+}
+
+static void lottery_enqueue(void *state, int task, long remaining,
+                            int priority) {
+    struct lottery_s *q = state;
+    int p = priority < 1 ? 0 : priority > TICKETS_MAX ? TICKETS_MAX - 1
+                                                   : priority - 1;
+
+    (void)remaining;
+    q->tasks[p][q->nb[p]++] = task;
+}
+
+static int lottery_dequeue(void *state, long *slices) {
+    struct lottery_s *q = state;
+    uint64_t total = 0, ticket;
+    int p, k, task;
+
+    for (p = 0; p < TICKETS_MAX; p++)
+        total += (uint64_t)q->nb[p] * (p + 1);
+    if (total == 0)
+        return -1;
+
+    q->rng ^= q->rng << 13;
+    q->rng ^= q->rng >> 7;
+    q->rng ^= q->rng << 17;
+    ticket = q->rng % total;
+
+    for (p = 0; ticket >= (uint64_t)q->nb[p] * (p + 1); p++)
+        ticket -= (uint64_t)q->nb[p] * (p + 1);
+
+    // remove the winner, the last task of the array takes its place
+    k = ticket / (p + 1);
+    task = q->tasks[p][k];
+    q->tasks[p][k] = q->tasks[p][--q->nb[p]];
+
+    *slices = 1;
+    return task;
+}
+
+/*
+ * shortest remaining quanta
+ *
+ * One list per number of remaining quanta, and a two-level bitmap of the
+ * non-empty lists to find the shortest one in a few words.
+ */
+
+struct srq_s {
+    struct fifo_s *lists; // indexed by the remaining quanta
+    long max;             // greatest number of remaining quanta
+    uint64_t *bits;       // bit r set if lists[r] is not empty
+    uint64_t *summary;    // bit w set if bits[w] != 0
+    long nb_words, nb_summary;
+    int *next;
+};
+
+static void *srq_create(int nb_tasks, long max_quanta, unsigned seed) {
+    struct srq_s *q = xcalloc(1, sizeof(struct srq_s));
+
+    (void)seed;
+    q->max = max_quanta;
+    q->lists = xcalloc(max_quanta + 1, sizeof(struct fifo_s));
+    for (long r = 0; r <= max_quanta; r++)
+        fifo_init(&q->lists[r]);
+    q->nb_words = (max_quanta + 64) / 64;
+    q->nb_summary = (q->nb_words + 63) / 64;
+    q->bits = xcalloc(q->nb_words, sizeof(uint64_t));
+    q->summary = xcalloc(q->nb_summary, sizeof(uint64_t));
+    q->next = xcalloc(nb_tasks, sizeof(int));
+    return q;
+}
+
+static void srq_destroy(void *state) {
+    struct srq_s *q = state;
+
+    free(q->lists);
+    free(q->bits);
+    free(q->summary);
+    free(q->next);
+    free(q);
+}
+
+static void srq_enqueue(void *state, int task, long remaining, int priority) {
+    struct srq_s *q = state;
+    long r = remaining > q->max ? q->max : remaining < 0 ? 0 : remaining;
+
+    (void)priority;
+    fifo_push(&q->lists[r], q->next, task);
+    q->bits[r / 64] |= 1ull << (r % 64);
+    q->summary[r / 4096] |= 1ull << (r / 64 % 64);
+}
+
+static int srq_dequeue(void *state, long *slices) {
+    struct srq_s *q = state;
+    long s, w, r;
+    int task;
+
+    for (s = 0; s < q->nb_summary && q->summary[s] == 0; s++)
+        ;
+    if (s == q->nb_summary)
+        return -1;
+
+    w = s * 64 + __builtin_ctzll(q->summary[s]);
+    r = w * 64 + __builtin_ctzll(q->bits[w]);
+    task = fifo_pop(&q->lists[r], q->next);
+    if (q->lists[r].head == -1 && (q->bits[w] &= ~(1ull << (r % 64))) == 0)
+        q->summary[s] &= ~(1ull << (w % 64));
+
+    *slices = 1;
+    return task;
+}
+
+/*
+ * interface
+ */
+
+static const struct policy_ops_s policies[] = {
+    {"rr", rr_create, rr_destroy, rr_enqueue, rr_dequeue},
+    {"mlfq", mlfq_create, mlfq_destroy, mlfq_enqueue, mlfq_dequeue},
+    {"lottery", lottery_create, lottery_destroy, lottery_enqueue,
+     lottery_dequeue},
+    {"srq", srq_create, srq_destroy, srq_enqueue, srq_dequeue},
+};
+
+policy_t *policy_create(const char *name, int nb_tasks, long max_quanta,
+                        unsigned seed) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) != 0)
+            continue;
+
+        policy_t *p = xcalloc(1, sizeof(policy_t));
+        p->ops = &policies[i];
+        p->state = p->ops->create(nb_tasks, max_quanta, seed);
+        return p;
+    }
+
+    return NULL;
+}
+
+void policy_destroy(policy_t *p) {
+    p->ops->destroy(p->state);
+    free(p);
+}
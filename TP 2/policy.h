@@ -0,0 +1,63 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+/*
+ * Scheduling policies of the ordonnanceur : each one keeps the ready tasks,
+ * known by their index, and tells which one runs next. Every operation is
+ * O(1) (or bounded by a small constant : levels, priorities, words of a
+ * bitmap).
+ *
+ *      rr      : round robin, a FIFO queue
+ *      mlfq    : multilevel feedback queue, a task is demoted after each
+ *                quantum and runs longer quanta at lower levels, every task
+ *                is boosted back to the top level from time to time
+ *      lottery : random draw weighted by the priority (the tickets)
+ *      srq     : shortest remaining quanta first
+ */
+
+#include <stdnoreturn.h>
+
+#define TICKETS_MAX 8 // priorities (tickets) range from 1 to TICKETS_MAX
+
+// print an error message (and errno if syserr == 1) then exit(1)
+noreturn void alert(int syserr, const char *msg, ...);
+
+typedef struct policy_s policy_t;
+
+/// the operations of a policy
+struct policy_ops_s {
+    const char *name;
+    // allocate the state of the policy for tasks 0 to nb_tasks - 1
+    void *(*create)(int nb_tasks, long max_quanta, unsigned seed);
+    void (*destroy)(void *state);
+    // the task is ready, with some quanta left to run
+    void (*enqueue)(void *state, int task, long remaining, int priority);
+    // remove the next task to run (-1 if none) and the length of its
+    // quantum, in number of quanta
+    int (*dequeue)(void *state, long *slices);
+};
+
+/// a policy and its state
+struct policy_s {
+    const struct policy_ops_s *ops;
+    void *state;
+};
+
+// names of the policies, for the messages
+extern const char *policy_names;
+
+// create a policy from its name, NULL if there is no such policy
+policy_t *policy_create(const char *name, int nb_tasks, long max_quanta,
+                        unsigned seed);
+void policy_destroy(policy_t *p);
+
+static inline void policy_enqueue(policy_t *p, int task, long remaining,
+                                  int priority) {
+    p->ops->enqueue(p->state, task, remaining, priority);
+}
+
+static inline int policy_dequeue(policy_t *p, long *slices) {
+    return p->ops->dequeue(p->state, slices);
+}
+
+#endif
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE // fwrite_unlocked
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "policy.h"
+#include "simulate.h"
+
+/// a task of the trace
+struct sim_task_s {
+    int64_t arrival; // in quanta
+    long remaining;  // quanta left to run
+    int priority;
+};
+
+// kinds of events, at the same time the arrivals come first
+#define EV_ARRIVAL 0
+#define EV_END 1 // end of the run of a task
+
+/// an event of the simulation
+struct event_s {
+    int64_t time;
+    int type;
+    int task;
+};
+
+/// the event list, a binary heap ordered by time, kind and task
+struct heap_s {
+    struct event_s *v;
+    size_t nb, cap;
+};
+
+static int event_before(const struct event_s *a, const struct event_s *b) {
+    if (a->time != b->time)
+        return a->time < b->time;
+    if (a->type != b->type)
+        return a->type < b->type;
+    return a->task < b->task;
+}
+
+static void heap_push(struct heap_s *h, int64_t time, int type, int task) {
+    struct event_s ev = {time, type, task};
+    size_t i, parent;
+
+    if (h->nb == h->cap) {
+        h->cap = h->cap ? 2 * h->cap : 16;
+        if ((h->v = realloc(h->v, h->cap * sizeof(struct event_s))) == NULL)
+            alert(0, "realloc");
+    }
+
+    for (i = h->nb++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (!event_before(&ev, &h->v[parent]))
+            break;
+        h->v[i] = h->v[parent];
+    }
+    h->v[i] = ev;
+}
+
+static struct event_s heap_pop(struct heap_s *h) {
+    struct event_s top = h->v[0], last = h->v[--h->nb];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < h->nb) {
+        if (child + 1 < h->nb && event_before(&h->v[child + 1], &h->v[child]))
+            child++;
+        if (!event_before(&h->v[child], &last))
+            break;
+        h->v[i] = h->v[child];
+        i = child;
+    }
+    h->v[i] = last;
+    return top;
+}
+
+/**
+ * @brief read a trace
+ *
+ * @param trace the file, "-" for stdin
+ * @param nb number of tasks read
+ * @param max_quanta greatest number of quanta of a task
+ * @return struct sim_task_s* - the tasks, in the order of the trace
+ */
+static struct sim_task_s *read_trace(const char *trace, int *nb,
+                                     long *max_quanta) {
+    FILE *f = strcmp(trace, "-") == 0 ? stdin : fopen(trace, "r");
+    struct sim_task_s *tasks = NULL;
+    size_t cap = 0, n = 0, len = 0;
+    char *line = NULL, *p, *end;
+    long lineno = 0;
+    int ok;
+
+    if (f == NULL)
+        alert(1, "%s", trace);
+
+    *max_quanta = 0;
+    while (getline(&line, &len, f) != -1) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        if (*p == '\n' || *p == '\0')
+            continue;
+
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            if ((tasks = realloc(tasks, cap * sizeof(*tasks))) == NULL)
+                alert(0, "realloc");
+        }
+        struct sim_task_s *t = &tasks[n];
+
+        errno = 0;
+        t->arrival = strtoll(p, &end, 10);
+        ok = end != p;
+        t->remaining = strtol(p = end, &end, 10);
+        ok = ok && end != p;
+        for (p = end; *p == ' ' || *p == '\t'; p++)
+            ;
+        t->priority = 1;
+        if (*p != '\n' && *p != '\0') {
+            t->priority = strtol(p, &end, 10);
+            ok = ok && end != p;
+            p = end;
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\n')
+            p++;
+        if (!ok || errno != 0 || *p != '\0' || t->arrival < 0 ||
+            t->remaining <= 0 || t->priority < 1 ||
+            t->priority > TICKETS_MAX || n == INT32_MAX)
+            alert(0, "%s:%ld: bad task, expected: arrival quanta [priority]",
+                  trace, lineno);
+
+        if (t->remaining > *max_quanta)
+            *max_quanta = t->remaining;
+        n++;
+    }
+    if (ferror(f))
+        alert(1, "%s", trace);
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+    *nb = n;
+    return tasks;
+}
+
+static const struct sim_task_s *sort_tasks; // tasks sorted by cmp_arrival
+
+static int cmp_arrival(const void *a, const void *b) {
+    int i = *(const int *)a, j = *(const int *)b;
+    int64_t x = sort_tasks[i].arrival, y = sort_tasks[j].arrival;
+
+    return x != y ? (x > y) - (x < y) : (i > j) - (i < j);
+}
+
+/**
+ * @brief print an event, without printf which is the bottleneck here
+ *
+ * @param what SURP, EVIP or TERM
+ * @param task the task
+ */
+static void print_event(const char *what, int task) {
+    char buf[32], *p = buf + sizeof(buf);
+
+    *--p = '\n';
+    do
+        *--p = '0' + task % 10;
+    while ((task /= 10) > 0);
+    p -= 15;
+    memcpy(p, what, 4);
+    memcpy(p + 4, " - process ", 11);
+    fwrite_unlocked(p, 1, buf + sizeof(buf) - p, stdout);
+}
+
+void simulate(const char *trace, const char *policy, int stats) {
+    struct heap_s heap = {NULL, 0, 0};
+    struct timespec t0, t1;
+    long max_quanta, slices = 1, nb_events = 0;
+    int64_t clock = 0, turnaround_sum = 0, quanta_sum = 0;
+    int n, next = 0, running = -1;
+    int *order;
+
+    struct sim_task_s *tasks = read_trace(trace, &n, &max_quanta);
+    if (n == 0)
+        alert(0, "%s: no task", trace);
+
+    // a fixed seed, so that the simulations can be replayed
+    policy_t *pol = policy_create(policy, n, max_quanta, 1);
+    if (pol == NULL)
+        alert(0, "bad policy: %s (%s)", policy, policy_names);
+
+    // the arrivals enter the event list one after the other, in order, so
+    // that the list holds two events at most
+    if ((order = malloc(sizeof(int) * n)) == NULL)
+        alert(0, "malloc");
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+        quanta_sum += tasks[i].remaining;
+    }
+    sort_tasks = tasks;
+    qsort(order, n, sizeof(int), cmp_arrival);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    heap_push(&heap, tasks[order[0]].arrival, EV_ARRIVAL, order[0]);
+
+    while (heap.nb > 0) {
+        struct event_s ev = heap_pop(&heap);
+        struct sim_task_s *t = &tasks[ev.task];
+
+        clock = ev.time;
+        nb_events++;
+
+        if (ev.type == EV_ARRIVAL) {
+            policy_enqueue(pol, ev.task, t->remaining, t->priority);
+            if (++next < n)
+                heap_push(&heap, tasks[order[next]].arrival, EV_ARRIVAL,
+                          order[next]);
+        } else {
+            print_event("EVIP", ev.task);
+            if ((t->remaining -= slices) > 0)
+                policy_enqueue(pol, ev.task, t->remaining, t->priority);
+            else {
+                print_event("TERM", ev.task);
+                turnaround_sum += clock - t->arrival;
+            }
+            running = -1;
+        }
+
+        // the cpu is given once every event of this time has been handled
+        if (running == -1 && (heap.nb == 0 || heap.v[0].time > clock) &&
+            (running = policy_dequeue(pol, &slices)) != -1) {
+            if (slices > tasks[running].remaining)
+                slices = tasks[running].remaining;
+            print_event("SURP", running);
+            heap_push(&heap, clock + slices, EV_END, running);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (fflush(stdout) == EOF)
+        alert(1, "stdout");
+
+    if (stats) {
+        double elapsed =
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+        fprintf(stderr,
+                "simulation of %d tasks with policy %s: %ld events in %.3f s "
+                "(%.2f M events/s)\n",
+                n, policy, nb_events, elapsed, nb_events / elapsed / 1e6);
+        fprintf(stderr,
+                "makespan %jd quanta, turnaround mean %.1f quanta, waiting "
+                "mean %.1f quanta\n",
+                (intmax_t)clock, (double)turnaround_sum / n,
+                (double)(turnaround_sum - quanta_sum) / n);
+    }
+
+    policy_destroy(pol);
+    free(heap.v);
+    free(order);
+    free(tasks);
+}
@@ -0,0 +1,22 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+/*
+ * Discrete event simulation of the ordonnanceur (--simulate) : no process and
+ * no signal, a single cpu and a virtual clock counted in quanta. The policies
+ * are the ones of the ordonnanceur (policy.h).
+ *
+ * The tasks come from a trace, one per line (# starts a comment) :
+ *      arrival quanta [priority]
+ * with the arrival in quanta since the start, and the priority from 1 (the
+ * default) to TICKETS_MAX. The tasks are numbered in the order of the trace.
+ *
+ * The events SURP, EVIP and TERM are printed as the ordonnanceur does, TERM
+ * right after the last EVIP of a task.
+ */
+
+// simulate the tasks of a trace ("-" for stdin) with a policy, print the
+// statistics of the simulation on stderr if stats is not 0
+void simulate(const char *trace, const char *policy, int stats);
+
+#endif
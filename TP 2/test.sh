@@ -136,6 +136,31 @@ test_1()
     $PROG 1 1 > $TMP/stdout 2> $TMP/stderr
     if success $?;                 then                                                  return 1; fi
     echo "OK"
+
+    #################################################################################################
+    echo -n "Test 1.6 - unité du quantum invalide................"
+    $PROG 1h 1 > $TMP/stdout 2> $TMP/stderr
+    if echec $?;                   then                                                  return 1; fi
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 1.7 - politique inconnue......................."
+    $PROG -p fifo 1 1 > $TMP/stdout 2> $TMP/stderr
+    if echec $?;                   then                                                  return 1; fi
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 1.8 - commandes avec le transport futex........"
+    $PROG -x -t futex 1 true > $TMP/stdout 2> $TMP/stderr
+    if echec $?;                   then                                                  return 1; fi
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 1.9 - trace de simulation invalide............."
+    echo "0 -1" > $TMP/trace
+    $PROG --simulate $TMP/trace > $TMP/stdout 2> $TMP/stderr
+    if echec $?;                   then                                                  return 1; fi
+    echo "OK"
 }
 
 test_2()
@@ -171,6 +196,61 @@ EOF
     grep -v TERM $TMP/stdout > $TMP/stdout2
     ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
     echo "OK"
+
+    #################################################################################################
+    echo -n "Test 2.3 - affichage avec le transport futex........"
+    $PROG -t futex 10ms 1 1 1 1 > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    grep -v TERM $TMP/stdout > $TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 2.4 - simulation d'une trace..................."
+    cat > $TMP/sortie <<EOF
+SURP - process 0
+EVIP - process 0
+SURP - process 1
+EVIP - process 1
+TERM - process 1
+SURP - process 2
+EVIP - process 2
+TERM - process 2
+SURP - process 0
+EVIP - process 0
+TERM - process 0
+EOF
+    printf "0 2\n0 1 # commentaire\n\n1 1 3\n" > $TMP/trace
+    $PROG --simulate $TMP/trace > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    ! cmp $TMP/stdout $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 2.5 - journal des événements..................."
+    cat > $TMP/sortie <<EOF
+SURP - process 0
+EVIP - process 0
+SURP - process 1
+EVIP - process 1
+SURP - process 0
+EVIP - process 0
+EOF
+    $PROG -L text 10ms 2 1 > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    grep -v TERM $TMP/stdout > $TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
+    [ $(grep -c TERM $TMP/stdout) -ne 2 ] && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 2.6 - journal des événements en JSON..........."
+    $PROG -L json 10ms 2 1 > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    [ $(grep -c '"ph":"X"' $TMP/stdout) -ne 3 ] && echo "échec : stdout non conforme" && return 1
+    [ $(grep -c '"ph":"i"' $TMP/stdout) -ne 2 ] && echo "échec : stdout non conforme" && return 1
+    [ "$(tail -1 $TMP/stdout)" != "]}" ] && echo "échec : stdout non conforme" && return 1
+    echo "OK"
 }
 
 test_3()
@@ -216,6 +296,69 @@ EOF
     ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
     echo "OK"
 
+    #################################################################################################
+    echo -n "Test 3.4 - politique srq, le plus court d'abord....."
+    cat > $TMP/sortie <<EOF
+TERM - process 1
+TERM - process 2
+TERM - process 0
+EOF
+    $PROG -p srq 1ms 3 1 2 > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    grep TERM $TMP/stdout > $TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 3.5 - politiques mlfq et lottery..............."
+    for P in mlfq lottery; do
+        $PROG -p $P 1ms 3 1 6 2 > $TMP/stdout 2> $TMP/stderr
+        if success $?;             then                                                  return 1; fi
+        [ $(grep -c TERM $TMP/stdout) -ne 4 ] && echo "échec : stdout non conforme" && return 1
+    done
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 3.6 - 4 processus sur 2 cœurs.................."
+    $PROG -c 2 10ms 2 1 3 2 > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    [ $(grep -c TERM $TMP/stdout) -ne 4 ] && echo "échec : stdout non conforme" && return 1
+    [ $(grep -c SURP $TMP/stdout) -ne 8 ] && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 3.7 - commandes externes......................."
+    cat > $TMP/sortie <<EOF
+TERM - process 0
+TERM - process 2
+TERM - process 1
+EOF
+    $PROG -x 20ms true "sleep 0.1" "echo fini" > $TMP/stdout 2> $TMP/stderr
+    if success $?;                 then                                                  return 1; fi
+    grep TERM $TMP/stdout > $TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie > /dev/null 2>&1 && echo "échec : stdout non conforme" && return 1
+    ! grep -q "^fini$" $TMP/stdout && echo "échec : stdout non conforme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 3.8 - bilan des commandes externes............."
+    $PROG -x -s 20ms true "exit 3" > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo "échec => code de retour != 0" && return 1
+    ! grep -q "^1 *3 .*exit 3$" $TMP/stderr && echo "échec : pas de bilan" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 3.9 - 4 cœurs et quanta de 1 ms................"
+    # des arrêts simultanés sur plusieurs cœurs ne doivent pas se perdre
+    for I in $(seq 5); do
+        timeout 10 $PROG -c 4 1ms 20 20 20 20 20 20 20 20 > $TMP/stdout 2> $TMP/stderr
+        RES=$?
+        [ $RES -eq 124 ] && echo "échec : attente infinie" && return 1
+        if success $RES;           then                                                  return 1; fi
+        [ $(grep -c SURP $TMP/stdout) -ne 160 ] && echo "échec : stdout non conforme" && return 1
+    done
+    echo "OK"
+
 }
 
 test_4 ()
@@ -242,6 +385,70 @@ test_4 ()
     $PROG 2 3 2 > $TMP/stdout 2> $TMP/stderr
     ! chrono_stop 10000 10050 2> $TMP/chrono && echo -n "échec : " && cat $TMP/chrono && return 1
     echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.4 - quanta de 250 ms durée totale 1 sec......"
+    chrono_start
+    $PROG 250ms 1 1 1 1 > $TMP/stdout 2> $TMP/stderr
+    ! chrono_stop 1000 1100 2> $TMP/chrono && echo -n "échec : " && cat $TMP/chrono && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.5 - quanta de 500 us et statistiques........."
+    $PROG -s 500us 20 20 > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo "échec => code de retour != 0" && return 1
+    [ $(grep -c SURP $TMP/stdout) -ne 40 ] && echo "échec : stdout non conforme" && return 1
+    ! grep -q "jitter over 40 runs" $TMP/stderr && echo "échec : pas de statistiques" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.6 - mode stress avec 300 processus..........."
+    $PROG -S 300 100us 1 2 > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo "échec => code de retour != 0" && return 1
+    [ $(grep -c TERM $TMP/stdout) -ne 300 ] && echo "échec : stdout non conforme" && return 1
+    [ $(grep -c SURP $TMP/stdout) -ne 450 ] && echo "échec : stdout non conforme" && return 1
+    ! grep -q "overhead per switch" $TMP/stderr && echo "échec : pas de statistiques" && return 1
+    ! grep -q "^\.\.\. 268 more processes$" $TMP/stderr && echo "échec : bilan non tronqué" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.7 - transport futex durée totale 1 sec......."
+    chrono_start
+    $PROG -t futex 250ms 1 1 1 1 > $TMP/stdout 2> $TMP/stderr
+    ! chrono_stop 1000 1100 2> $TMP/chrono && echo -n "échec : " && cat $TMP/chrono && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.8 - 2 cœurs durée totale 1 sec..............."
+    chrono_start
+    $PROG -c 2 250ms 2 1 1 2 2 > $TMP/stdout 2> $TMP/stderr
+    ! chrono_stop 1000 1100 2> $TMP/chrono && echo -n "échec : " && cat $TMP/chrono && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.9 - bilan et histogrammes par processus......"
+    $PROG -s 1ms 3 1 2 > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo "échec => code de retour != 0" && return 1
+    ! grep -q "^0 *0 *3 *2 " $TMP/stderr && echo "échec : pas de bilan" && return 1
+    ! grep -q "^response time (ms): 3 values" $TMP/stderr && echo "échec : pas d'histogramme" && return 1
+    ! grep -q "^signal delivery (us): 6 values" $TMP/stderr && echo "échec : pas d'histogramme" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.10 - vérification de l'horloge du chrono....."
+    init_chrono
+    $CHRONO -c > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo -n "échec : " && cat $TMP/stderr && return 1
+    ! $CHRONO -n $($CHRONO) | grep -qx "[0-9][0-9]*" && echo "échec : durée en ns" && return 1
+    echo "OK"
+
+    #################################################################################################
+    echo -n "Test 4.11 - mesures répétées avec chrono run........"
+    $CHRONO run -n 3 -w 1 -p 50 -m 400 -M 450 -- $PROG 100ms 1 1 1 1 > $TMP/stdout 2> $TMP/stderr
+    [ $? -ne 0 ] && echo -n "échec : " && cat $TMP/stderr && return 1
+    ! grep -q "^wall (ms) " $TMP/stdout && echo "échec : pas de mesures" && return 1
+    ! grep -q "^p50=.* ok$" $TMP/stdout && echo "échec : pas de contrôle" && return 1
+    echo "OK"
 }
 
 test_5()
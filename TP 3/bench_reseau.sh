@@ -0,0 +1,49 @@
+#!/bin/sh
+
+# Compare le débit du réseau (trames livrées par seconde) quand les trames
+# sont lues et écrites par lots (par défaut) et une à une (-u), par tubes
+# (par défaut) et par anneaux en mémoire partagée (-t shm). Chaque
+# station envoie $TRAMES trames à la suivante, la dernière les diffuse à
+# toutes les autres.
+#
+# Attention : les fichiers STA_* du répertoire courant sont remplacés.
+#
+# usage : ./bench_reseau.sh [stations]
+
+PROG="./reseau"
+TRAME="./trame"
+STATIONS=${1:-4}
+TRAMES=${TRAMES:-65536} # puissance de 2
+ESSAIS=${ESSAIS:-3}
+
+[ ! -x $PROG -o ! -x $TRAME ] && echo "Il faut compiler '$PROG' (cf Makefile)" && exit 1
+
+rm -f STA_*
+for S in $(seq $STATIONS); do
+    D=$((S % STATIONS + 1))
+    [ $S -eq $STATIONS ] && D=0
+    $TRAME $S $D abcd
+    N=1
+    while [ $N -lt $TRAMES ]; do
+        cat STA_$S STA_$S > STA_tmp && mv STA_tmp STA_$S
+        N=$((N * 2))
+    done
+done
+
+# meilleur débit sur $ESSAIS essais, la sortie des stations est jetée
+debit ()
+{
+    for E in $(seq $ESSAIS); do
+        $PROG -s $* 2>&1 > /dev/null |
+            sed -n 's/.*(\([0-9]*\) frames\/s), \([0-9.]*\) frames per read.*/\1 \2/p'
+    done | sort -n | tail -1
+}
+
+echo "stations=$STATIONS trames par station=$TRAMES"
+printf "%-14s %14s %16s\n" "chemin" "trames/s" "trames par read"
+printf "%-14s %14s %16s\n" "lots" $(debit $STATIONS)
+printf "%-14s %14s %16s\n" "trame à trame" $(debit -u $STATIONS)
+printf "%-14s %14s %16s\n" "shm, lots" $(debit -t shm $STATIONS)
+printf "%-14s %14s %16s\n" "shm, à trame" $(debit -t shm -u $STATIONS)
+
+rm -f STA_*
@@ -4,7 +4,7 @@ Small program to simulate a ethernet network of some stations connected via a
 commutator. The parent process is the commutator, the child processes are the
 stations.
 
-The main issue of this program is that the pipes can reach their maximum size
+The main issue of this program was that the pipes can reach their maximum size
 before the child process can read them.
 
 For example, let's say we have n+1 stations (s0, s1, ..., sn), where n is an
@@ -15,6 +15,32 @@ the commutator process will read. The commutator process will then send the
 messages to s0. Meanwhile, s0 should still be reading its own file, and thus
 will not be able to read the messages from the commutator.
 
+Each station now has its own pipe to the commutator (ingress) as well as its
+pipe from it (egress). The commutator never blocks : its descriptors are
+non-blocking and multiplexed with epoll, and the frames a station cannot take
+yet wait in the queue of its port, which grows as needed. The ingress pipes
+are thus always drained, and a station writing its file never waits for a
+station which is itself writing.
+
+The frames are moved in batches : a station reads its file and the pipe from
+the commutator many frames at a time, and the commutator writes the queue of a
+port with writev, in two parts when the circular buffer wraps. A batch holds
+at most PIPE_BUF bytes of whole frames, so that a write to a pipe is atomic :
+the frames never tear, and a read of a multiple of the frame size always gets
+whole frames. The option -u moves a single frame per system call instead, as
+before, for comparison (see bench_reseau.sh).
+
+With -t shm, the links are not pipes but single producer single consumer rings
+in a shared mapping, one for each direction of each station : a frame is
+copied into the ring and out of it, without system call. The reader of an
+empty ring and the writer of a full ring sleep on an eventfd, which the other
+side only signals when asked to. The eventfds of the commutator are watched
+by epoll, as the pipes are.
+
+A station may terminate before it closes its links, which only a pipe notices.
+The commutator thus also watches a pidfd of each station : once a station has
+terminated, what it sent is still delivered, and what is sent to it dropped.
+
 Additional note
 Pipes are closed before (not after) any function jump, as an arbitrary choice.
 */
@@ -26,14 +52,20 @@ Pipes are closed before (not after) any function jump, as an arbitrary choice.
 #include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include <wait.h>
@@ -41,6 +73,12 @@ Pipes are closed before (not after) any function jump, as an arbitrary choice.
 #define PATH 1 << 8
 #define MAXSTA 10u
 #define PAYLOAD_SIZE 4ul
+#define RING_SIZE 4096u // frames in a ring, a power of 2
+
+// tags of the descriptors watched by epoll : i for the ingress link of the
+// i-th station, EGRESS + i for its egress link, DEATH + i for its pidfd
+#define EGRESS (MAXSTA + 1)
+#define DEATH (2 * (MAXSTA + 1))
 
 #define CHK(op)            \
     do {                   \
@@ -75,6 +113,282 @@ struct info_s {
     char payload[PAYLOAD_SIZE]; // payload
 };
 
+// greatest number of frames read or written at once : whole frames of at most
+// PIPE_BUF bytes, which a pipe reads and writes atomically
+#define BATCH (PIPE_BUF / sizeof(struct info_s))
+
+/// a single producer single consumer ring of frames, in shared memory
+struct ring_s {
+    _Alignas(64) atomic_uint head; // frames written so far, by the producer
+    atomic_uint closed;            // the producer will write no more
+    atomic_uint wants_room;        // the producer sleeps, the ring is full
+    int data_fd;                   // eventfd waking the consumer
+    int room_fd;                   // eventfd waking the producer
+    _Alignas(64) atomic_uint tail; // frames read so far, by the consumer
+    atomic_uint wants_data;        // the consumer sleeps, the ring is empty
+    _Alignas(64) struct info_s frames[RING_SIZE];
+};
+
+/// a link between a station and the commutator, in one direction
+struct link_s {
+    int fd;              // the end of the pipe, -1 for a ring
+    struct ring_s *ring; // the ring (-t shm), NULL for a pipe
+};
+
+/// what the commutator measures (-s)
+struct stats_s {
+    long nb_received; // frames sent by the stations
+    long nb_frames;   // frames delivered to the stations, once per port
+    long nb_reads;    // reads of the links from the stations
+    long nb_writes;   // writes to the links to the stations
+};
+
+/// frames waiting to be sent to a station, a circular buffer growing as needed
+struct queue_s {
+    struct info_s *frames;
+    size_t head; // first frame to send
+    size_t nb;   // number of frames waiting
+    size_t cap;  // number of frames the buffer can hold
+    int watched; // epoll watches that the pipe has room
+    int dead;    // the station terminated, its frames are dropped
+};
+
+/**
+ * @brief initialize a ring, before the fork of its two sides
+ *
+ * @param r the ring, in a shared mapping
+ * @param data_flags flags of the eventfd of the consumer (EFD_NONBLOCK or 0)
+ * @param room_flags flags of the eventfd of the producer
+ */
+void ring_init(struct ring_s *r, int data_flags, int room_flags) {
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->closed, 0);
+    atomic_init(&r->wants_room, 0);
+    // the first frame wakes the consumer
+    atomic_init(&r->wants_data, 1);
+    CHK(r->data_fd = eventfd(0, data_flags));
+    CHK(r->room_fd = eventfd(0, room_flags));
+}
+
+void ring_destroy(struct ring_s *r) {
+    CHK(close(r->data_fd));
+    CHK(close(r->room_fd));
+}
+
+/**
+ * @brief copy frames into a ring, as many as it has room for, and wake the
+ * consumer if it sleeps
+ *
+ * @param r the ring
+ * @param f the frames
+ * @param nb number of frames
+ * @return size_t - the number of frames written
+ */
+size_t ring_put(struct ring_s *r, const struct info_s *f, size_t nb) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (nb > RING_SIZE - (head - tail)) {
+        nb = RING_SIZE - (head - tail);
+    }
+    for (size_t k = 0; k < nb; k++) {
+        r->frames[(head + k) & (RING_SIZE - 1)] = f[k];
+    }
+
+    // publish the frames before looking at wants_data (seq_cst on both
+    // sides), so that either the consumer sees them or it is woken
+    atomic_store(&r->head, head + nb);
+    if (nb > 0 && atomic_load(&r->wants_data) &&
+        atomic_exchange(&r->wants_data, 0)) {
+        CHK(eventfd_write(r->data_fd, 1));
+    }
+    return nb;
+}
+
+/**
+ * @brief copy frames out of a ring, as many as there are up to nb, and wake
+ * the producer if it sleeps
+ *
+ * @param r the ring
+ * @param f where to copy the frames
+ * @param nb greatest number of frames
+ * @return size_t - the number of frames read
+ */
+size_t ring_get(struct ring_s *r, struct info_s *f, size_t nb) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (nb > head - tail) {
+        nb = head - tail;
+    }
+    for (size_t k = 0; k < nb; k++) {
+        f[k] = r->frames[(tail + k) & (RING_SIZE - 1)];
+    }
+
+    atomic_store(&r->tail, tail + nb);
+    if (nb > 0 && atomic_load(&r->wants_room) &&
+        atomic_exchange(&r->wants_room, 0)) {
+        CHK(eventfd_write(r->room_fd, 1));
+    }
+    return nb;
+}
+
+/**
+ * @brief the consumer found the ring empty : ask to be woken
+ *
+ * @param r the ring
+ * @return int - 1 if it may sleep, 0 if frames came or the ring was closed
+ * meanwhile
+ */
+int ring_sleep_data(struct ring_s *r) {
+    atomic_store(&r->wants_data, 1);
+    if (atomic_load(&r->head) != atomic_load(&r->tail) ||
+        atomic_load(&r->closed)) {
+        // a wake up may still come, it is harmless
+        atomic_store(&r->wants_data, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief the producer found the ring full : ask to be woken
+ *
+ * @param r the ring
+ * @return int - 1 if it may sleep, 0 if room was made meanwhile
+ */
+int ring_sleep_room(struct ring_s *r) {
+    atomic_store(&r->wants_room, 1);
+    if (atomic_load(&r->head) - atomic_load(&r->tail) < RING_SIZE) {
+        atomic_store(&r->wants_room, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief the producer will write no more, wake the consumer if it sleeps
+ *
+ * @param r the ring
+ */
+void ring_close(struct ring_s *r) {
+    atomic_store(&r->closed, 1);
+    if (atomic_exchange(&r->wants_data, 0)) {
+        CHK(eventfd_write(r->data_fd, 1));
+    }
+}
+
+/**
+ * @brief the consumer has read every frame and the producer has closed
+ *
+ * @param r the ring
+ * @return int - 1 if the ring is done
+ */
+int ring_done(struct ring_s *r) {
+    // closed is set after the last frame is published
+    return atomic_load(&r->closed) &&
+           atomic_load(&r->head) == atomic_load(&r->tail);
+}
+
+/**
+ * @brief consume a wake up, if any
+ *
+ * @param fd the eventfd
+ */
+void wake_clear(int fd) {
+    eventfd_t v;
+
+    if (eventfd_read(fd, &v) == -1 && errno != EAGAIN && errno != EINTR) {
+        alert(1, "eventfd_read");
+    }
+}
+
+/**
+ * @brief [station] send frames to the commutator, waiting while the link is
+ * full
+ *
+ * @param l the link
+ * @param f the frames
+ * @param nb the number of frames, at most BATCH
+ */
+void link_send(struct link_s *l, const struct info_s *f, size_t nb) {
+    size_t n;
+
+    if (l->ring == NULL) {
+        // at most PIPE_BUF bytes, written atomically
+        CHK(write(l->fd, f, nb * sizeof(struct info_s)));
+        return;
+    }
+
+    while (nb > 0) {
+        n = ring_put(l->ring, f, nb);
+        f += n;
+        nb -= n;
+        if (nb > 0 && n == 0 && ring_sleep_room(l->ring)) {
+            wake_clear(l->ring->room_fd);
+        }
+    }
+}
+
+/**
+ * @brief [station] receive frames from the commutator, waiting while the
+ * link is empty
+ *
+ * @param l the link
+ * @param f where to copy the frames
+ * @param nb the greatest number of frames, at most BATCH
+ * @return size_t - the number of frames received, 0 once the link is closed
+ */
+size_t link_recv(struct link_s *l, struct info_s *f, size_t nb) {
+    ssize_t n;
+
+    if (l->ring == NULL) {
+        CHK(n = read(l->fd, f, nb * sizeof(struct info_s)));
+        // the commutator only writes whole frames
+        if (n % sizeof(struct info_s) != 0) {
+            alert(0, "torn packet from parent");
+        }
+        return n / sizeof(struct info_s);
+    }
+
+    while ((n = ring_get(l->ring, f, nb)) == 0 && !ring_done(l->ring)) {
+        if (ring_sleep_data(l->ring)) {
+            wake_clear(l->ring->data_fd);
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief [station] tell the commutator that no more frames will come
+ *
+ * @param l the link
+ */
+void link_close(struct link_s *l) {
+    if (l->ring == NULL) {
+        CHK(close(l->fd));
+    } else {
+        ring_close(l->ring);
+    }
+}
+
+/**
+ * @brief print whole lines on the standard output with a single write : the
+ * lines of the stations do not mix, even in a pipe
+ *
+ * @param lines the lines
+ * @param len their length, at most PIPE_BUF
+ */
+void print_lines(const char *lines, size_t len) {
+    ssize_t n;
+
+    // a short write only happens to a terminal or a file, not to a pipe
+    for (; len > 0; lines += n, len -= n) {
+        CHK(n = write(STDOUT_FILENO, lines, len));
+    }
+}
+
 /**
  * @brief child process that simulates a station
  *
@@ -86,14 +400,18 @@ struct info_s {
  * 6. Writes the new packets to a file (standard output)
  *
  * @param id the id of the station
- * @param in the file descriptor of the pipe to read from
- * @param out the file descriptor of the pipe to write to
+ * @param in the link to read from
+ * @param out the link to write to
+ * @param batch the number of frames read or written at once, up to BATCH
  */
-void child_main(int id, int in, int out) {
-    int fd, n, i;
+void child_main(int id, struct link_s *in, struct link_s *out, size_t batch) {
+    int fd, i;
+    ssize_t n;
     char filename[PATH];
-    struct sta_s sta;
-    struct info_s info;
+    struct sta_s sta[BATCH];
+    struct info_s info[BATCH];
+    char lines[PIPE_BUF]; // whole lines to print
+    size_t len = 0, nb;
 
     i = snprintf(filename, PATH, "STA_%d", id);
     if (i < 0 || i >= PATH) {
@@ -103,91 +421,405 @@ void child_main(int id, int in, int out) {
     CHK((fd = open(filename, O_RDONLY)));
 
     // format : (dest payload)
-    while ((n = read(fd, &sta, sizeof(sta))) > 0) {
+    while ((n = read(fd, sta, batch * sizeof(struct sta_s))) > 0) {
+        if (n % sizeof(struct sta_s) != 0) {
+            alert(0, "%s: truncated packet", filename);
+        }
+
         // decode
-        info.src = id; // here, decoding is adding the source station
-        info.dest = sta.dest;
-        strncpy(info.payload, sta.payload, PAYLOAD_SIZE);
+        nb = n / sizeof(struct sta_s);
+        for (size_t k = 0; k < nb; k++) {
+            info[k].src = id; // here, decoding is adding the source station
+            info[k].dest = sta[k].dest;
+            strncpy(info[k].payload, sta[k].payload, PAYLOAD_SIZE);
+        }
 
-        // send (dest payload) to parent via pipe
-        CHK(write(out, &info, sizeof(info)));
+        // send (dest payload) to parent
+        link_send(out, info, nb);
     }
     if (n == -1) {
         alert(1, "reading from %s", filename);
     }
 
     CHK(close(fd));
-    CHK(close(out));
+    link_close(out);
 
-    while ((n = read(in, &info, sizeof(info))) > 0) {
+    while ((nb = link_recv(in, info, batch)) > 0) {
         // wait for parent to send back (src dest payload)
         // print (id - src - dest - payload)
-        char payload[PAYLOAD_SIZE + 1];
-        strncpy(payload, info.payload, PAYLOAD_SIZE);
-        payload[PAYLOAD_SIZE] = '\0';
-        fprintf(stdout, "%d - %d - %d - %s\n", id, info.src, info.dest,
-                payload);
+        for (size_t k = 0; k < nb; k++) {
+            char payload[PAYLOAD_SIZE + 1], line[64];
+            strncpy(payload, info[k].payload, PAYLOAD_SIZE);
+            payload[PAYLOAD_SIZE] = '\0';
+            i = snprintf(line, sizeof(line), "%d - %d - %d - %s\n", id,
+                         info[k].src, info[k].dest, payload);
+            if (i < 0 || i >= (int)sizeof(line)) {
+                alert(0, "snprintf");
+            }
+            if (len + i > PIPE_BUF) {
+                print_lines(lines, len);
+                len = 0;
+            }
+            memcpy(lines + len, line, i);
+            len += i;
+        }
 
         // this is needed to avoid a mix of stdout and stderr in the terminal
-        i = fflush(stdout);
-        if (i != 0) {
-            alert(1, "fflush");
+        print_lines(lines, len);
+        len = 0;
+    }
+
+    if (in->ring == NULL) {
+        CHK(close(in->fd));
+    }
+}
+
+/**
+ * @brief add a frame at the end of a queue
+ *
+ * @param q the queue
+ * @param info the frame
+ */
+void queue_push(struct queue_s *q, const struct info_s *info) {
+    if (q->nb == q->cap) {
+        size_t cap = q->cap ? 2 * q->cap : 64;
+        struct info_s *frames = malloc(cap * sizeof(struct info_s));
+        if (frames == NULL) {
+            alert(0, "malloc");
+        }
+
+        // unwrap the frames at the start of the new buffer
+        for (size_t i = 0; i < q->nb; i++) {
+            frames[i] = q->frames[(q->head + i) % q->cap];
         }
+        free(q->frames);
+        q->frames = frames;
+        q->head = 0;
+        q->cap = cap;
     }
-    if (n == -1) {
-        alert(1, "reading from parent");
+    q->frames[(q->head + q->nb++) % q->cap] = *info;
+}
+
+/**
+ * @brief write the frames of a queue to a link until it is full, without
+ * blocking
+ *
+ * @param q the queue
+ * @param l the link, a non-blocking pipe or a ring
+ * @param batch the number of frames written at once, up to BATCH
+ * @param st the measures of the commutator
+ */
+void queue_flush(struct queue_s *q, struct link_s *l, size_t batch,
+                 struct stats_s *st) {
+    struct iovec iov[2];
+
+    while (q->nb > 0) {
+        // the frames from the head, then those at the start of the buffer
+        size_t nb = q->nb < batch ? q->nb : batch;
+        size_t first = q->cap - q->head < nb ? q->cap - q->head : nb;
+
+        if (l->ring != NULL) {
+            // a ring takes what it has room for
+            if ((nb = ring_put(l->ring, &q->frames[q->head], first)) == 0) {
+                if (ring_sleep_room(l->ring)) {
+                    return;
+                }
+                continue;
+            }
+        } else {
+            iov[0].iov_base = &q->frames[q->head];
+            iov[0].iov_len = first * sizeof(struct info_s);
+            iov[1].iov_base = q->frames;
+            iov[1].iov_len = (nb - first) * sizeof(struct info_s);
+
+            // at most PIPE_BUF bytes, written whole or not at all
+            if (writev(l->fd, iov, nb > first ? 2 : 1) == -1) {
+                // a station which terminated is soon known by its pidfd
+                if (errno == EAGAIN || errno == EPIPE) {
+                    return;
+                }
+                alert(1, "writing to station");
+            }
+        }
+        st->nb_writes++;
+        st->nb_frames += nb;
+        q->head = (q->head + nb) % q->cap;
+        q->nb -= nb;
+    }
+}
+
+/**
+ * @brief read frames from a link without blocking
+ *
+ * @param l the link, a non-blocking pipe or a ring
+ * @param f where to copy the frames
+ * @param nb the greatest number of frames, at most BATCH
+ * @return ssize_t - the number of frames read, 0 once the link is closed, -1
+ * if it is empty for now
+ */
+ssize_t link_read(struct link_s *l, struct info_s *f, size_t nb) {
+    ssize_t n;
+
+    if (l->ring == NULL) {
+        if ((n = read(l->fd, f, nb * sizeof(struct info_s))) == -1) {
+            if (errno == EAGAIN) {
+                return -1;
+            }
+            alert(1, "reading from station");
+        }
+        // the stations only write whole frames
+        if (n % sizeof(struct info_s) != 0) {
+            alert(0, "torn packet from station");
+        }
+        return n / sizeof(struct info_s);
+    }
+
+    while ((n = ring_get(l->ring, f, nb)) == 0) {
+        if (ring_done(l->ring)) {
+            return 0;
+        }
+        if (ring_sleep_data(l->ring)) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief watch or stop watching that the egress pipe of a station has room :
+ * the eventfd of a ring is always watched, it is only signalled when asked to
+ *
+ * @param epfd the epoll instance
+ * @param l the link
+ * @param q the queue of the port
+ * @param sta the station
+ */
+void egress_watch(int epfd, struct link_s *l, struct queue_s *q, long sta) {
+    int on = q->nb > 0;
+    struct epoll_event ev = {.events = on ? EPOLLOUT : 0,
+                             .data.u32 = EGRESS + sta};
+
+    if (l->ring == NULL && on != q->watched) {
+        CHK(epoll_ctl(epfd, EPOLL_CTL_MOD, l->fd, &ev));
+        q->watched = on;
+    }
+}
+
+/**
+ * @brief a station terminated while the commutator still serves it : what it
+ * has sent is read until its link is empty, what is sent to it is dropped
+ *
+ * @param epfd the epoll instance
+ * @param in the link from the station
+ * @param out the link to the station
+ * @param q the queue of its port
+ * @return long - the number of frames dropped from the queue
+ */
+long station_dead(int epfd, struct link_s *in, struct link_s *out,
+                  struct queue_s *q) {
+    long nb = q->nb;
+
+    // the station will never close its ring, a pipe is closed by its exit
+    if (in->ring != NULL) {
+        atomic_store(&in->ring->closed, 1);
     }
 
-    CHK(close(in));
+    // a pipe without reader is always ready, with an error
+    if (out->ring != NULL) {
+        CHK(epoll_ctl(epfd, EPOLL_CTL_DEL, out->ring->room_fd, NULL));
+    } else {
+        CHK(epoll_ctl(epfd, EPOLL_CTL_DEL, out->fd, NULL));
+    }
+    free(q->frames);
+    memset(q, 0, sizeof(*q));
+    q->dead = 1;
+    return nb;
 }
 
 /**
  * @brief function that simulates a commutator
  *
- * 1. Reads packets from a pipe
+ * 1. Reads packets from the links of the stations, as they come
  * 2. Determine the destination of the packet
- * 3. Writes the packet to the destination station
+ * 3. Queues the packet on the port of the destination station
+ * 4. Writes the queued packets as the links to the stations have room
+ * 5. Drops the packets of the stations which terminated too early
  *
- * @param pipesdes the array of file descriptors of the pipes int(*)[2]
+ * @param in the links from the stations, non-blocking
+ * @param out the links to the stations, non-blocking
+ * @param pids the stations
  * @param nb_sta the number of stations
+ * @param batch the number of frames read or written at once, up to BATCH
+ * @param st the measures of the commutator
  */
-void parent_main(int pipesdes[MAXSTA + 1][2], long nb_sta) {
-    // read (src dest payload) from children
-    int n;
-    struct info_s info;
-    while ((n = read(pipesdes[0][0], &info, sizeof(info))) > 0) {
-        // send (src dest payload) dest children via pipes
-        // if dest is undefined, send to all children except src
-        if (1 <= info.dest && info.dest <= nb_sta) {
-            CHK(write(pipesdes[info.dest][1], &info, sizeof(info)));
-        } else {
+void parent_main(struct link_s in[MAXSTA + 1], struct link_s out[MAXSTA + 1],
+                 pid_t pids[MAXSTA + 1], long nb_sta, size_t batch,
+                 struct stats_s *st) {
+    struct queue_s queues[MAXSTA + 1];
+    struct epoll_event evs[3 * MAXSTA];
+    struct info_s info[BATCH];
+    int pidfds[MAXSTA + 1];
+    int reading[MAXSTA + 1]; // the link from the station is still open
+    int epfd, nb_open = nb_sta;
+    long nb_queued = 0; // frames in all the queues
+
+    memset(queues, 0, sizeof(queues));
+    CHK(epfd = epoll_create1(EPOLL_CLOEXEC));
+    for (long i = 1; i < nb_sta + 1; i++) {
+        struct link_s *l = &in[i];
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = DEATH + i};
+
+        // glibc 2.36 has no header for pidfd_open(2)
+        CHK(pidfds[i] = syscall(SYS_pidfd_open, pids[i], 0));
+        CHK(epoll_ctl(epfd, EPOLL_CTL_ADD, pidfds[i], &ev));
+        reading[i] = 1;
+        ev.data.u32 = i;
+        CHK(epoll_ctl(epfd, EPOLL_CTL_ADD,
+                      l->ring ? l->ring->data_fd : l->fd, &ev));
+        l = &out[i];
+        ev.events = l->ring ? EPOLLIN : 0;
+        ev.data.u32 = EGRESS + i;
+        CHK(epoll_ctl(epfd, EPOLL_CTL_ADD,
+                      l->ring ? l->ring->room_fd : l->fd, &ev));
+    }
+
+    // until every station has sent all its packets and got all of its own
+    while (nb_open > 0 || nb_queued > 0) {
+        int n = epoll_wait(epfd, evs, 3 * MAXSTA, -1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        CHK(n);
+
+        for (int k = 0; k < n; k++) {
+            long i = evs[k].data.u32;
+            unsigned touched = 0; // ports which got frames
+
+            // a station terminated, only the frames it sent are still read
+            if (i >= DEATH) {
+                i -= DEATH;
+                CHK(epoll_ctl(epfd, EPOLL_CTL_DEL, pidfds[i], NULL));
+                CHK(close(pidfds[i]));
+                pidfds[i] = -1;
+                nb_queued -= station_dead(epfd, &in[i], &out[i], &queues[i]);
+                if (!reading[i] || in[i].ring == NULL) {
+                    continue;
+                }
+            }
+
+            // room in the link to a station
+            if (i >= EGRESS) {
+                i -= EGRESS;
+                if (queues[i].dead) {
+                    continue;
+                }
+                if (out[i].ring != NULL) {
+                    wake_clear(out[i].ring->room_fd);
+                }
+                nb_queued -= queues[i].nb;
+                queue_flush(&queues[i], &out[i], batch, st);
+                nb_queued += queues[i].nb;
+                egress_watch(epfd, &out[i], &queues[i], i);
+                continue;
+            }
+
+            // read (src dest payload) from a station until its link is empty
+            if (!reading[i]) {
+                continue; // its termination came first, with its last frames
+            }
+            if (in[i].ring != NULL) {
+                wake_clear(in[i].ring->data_fd);
+            }
+            ssize_t r;
+            while ((r = link_read(&in[i], info, batch)) > 0) {
+                st->nb_reads++;
+                st->nb_received += r;
+
+                for (ssize_t k = 0; k < r; k++) {
+                    // send (src dest payload) to dest
+                    // if dest is undefined, send to all children except src
+                    int dest = info[k].dest;
+                    int broadcast = dest < 1 || dest > nb_sta;
+                    for (long j = 1; j < nb_sta + 1; j++) {
+                        if (queues[j].dead) {
+                            continue;
+                        }
+                        if (j == dest || (broadcast && j != info[k].src)) {
+                            queue_push(&queues[j], &info[k]);
+                            nb_queued++;
+                            touched |= 1u << j;
+                        }
+                    }
+                }
+            }
+            if (r == 0) {
+                // the station has sent all its packets
+                if (in[i].ring != NULL) {
+                    CHK(epoll_ctl(epfd, EPOLL_CTL_DEL, in[i].ring->data_fd,
+                                  NULL));
+                } else {
+                    CHK(epoll_ctl(epfd, EPOLL_CTL_DEL, in[i].fd, NULL));
+                    CHK(close(in[i].fd));
+                }
+                reading[i] = 0;
+                nb_open--;
+            }
+
+            // send what the links have room for, the rest waits
             for (long j = 1; j < nb_sta + 1; j++) {
-                if (j != info.src) {
-                    CHK(write(pipesdes[j][1], &info, sizeof(info)));
+                if (touched & 1u << j) {
+                    nb_queued -= queues[j].nb;
+                    queue_flush(&queues[j], &out[j], batch, st);
+                    nb_queued += queues[j].nb;
+                    egress_watch(epfd, &out[j], &queues[j], j);
                 }
             }
         }
     }
-    if (n == -1) {
-        alert(1, "reading from children");
-    }
 
-    CHK(close(pipesdes[0][0]));
+    CHK(close(epfd));
     for (long i = 1; i < nb_sta + 1; i++) {
-        CHK(close(pipesdes[i][1]));
+        if (pidfds[i] != -1) {
+            CHK(close(pidfds[i]));
+        }
+        free(queues[i].frames);
+        link_close(&out[i]);
     }
 }
 
 int main(int argc, char *argv[]) {
-    long nb_sta; // number of stations
-
-    if (argc != 2) {
-        alert(0, "usage: %s <nb_sta>", argv[0]);
+    long nb_sta;         // number of stations
+    size_t batch = BATCH; // frames read or written at once
+    int stats = 0;       // print the measures of the commutator (-s)
+    int shm = 0;         // the links are rings in shared memory (-t shm)
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ust:")) != -1) {
+        switch (opt) {
+        case 'u':
+            batch = 1;
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 't':
+            if (strcmp(optarg, "shm") == 0) {
+                shm = 1;
+            } else if (strcmp(optarg, "pipe") != 0) {
+                alert(0, "bad transport: %s (pipe, shm)", optarg);
+            }
+            break;
+        default:
+            alert(0, "usage: %s [-u] [-s] [-t pipe|shm] <nb_sta>", argv[0]);
+        }
+    }
+    if (argc - optind != 1) {
+        alert(0, "usage: %s [-u] [-s] [-t pipe|shm] <nb_sta>", argv[0]);
     }
 
-    char *endptr;
-    nb_sta = strtol(argv[1], &endptr, 10);
-    if (endptr == argv[1] || *endptr != '\0') {
+    char *endptr, *arg = argv[optind];
+    nb_sta = strtol(arg, &endptr, 10);
+    if (endptr == arg || *endptr != '\0') {
         alert(1, "nb_sta is not a number");
     }
     if (errno == ERANGE) {
@@ -197,54 +829,121 @@ int main(int argc, char *argv[]) {
         alert(0, "nb_sta should be in [1, %d]", MAXSTA);
     }
 
-    // pipesdes[0] is the common shared pipe
-    // pipesdes[i] is the pipe to the i-th station, i = 1..nb_sta
-    int pipesdes[MAXSTA + 1][2];
-    CHK(pipe(pipesdes[0])); // children -> parent
+    // in[i] is the link from the i-th station, i = 1..nb_sta
+    // out[i] is the link to the i-th station
+    struct link_s in[MAXSTA + 1], out[MAXSTA + 1];
+    pid_t pids[MAXSTA + 1];
+    struct stats_s st = {0, 0, 0, 0};
+    struct timespec t0, t1;
+
+    // the rings of both directions, shared with the stations : the
+    // commutator never blocks on its eventfds, the stations do
+    struct ring_s *rings = NULL;
+    size_t rings_size = 2 * nb_sta * sizeof(struct ring_s);
+    if (shm) {
+        rings = mmap(NULL, rings_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (rings == MAP_FAILED) {
+            alert(1, "mmap");
+        }
+        for (long i = 1; i < nb_sta + 1; i++) {
+            in[i] = (struct link_s){-1, &rings[2 * i - 2]};
+            out[i] = (struct link_s){-1, &rings[2 * i - 1]};
+            ring_init(in[i].ring, EFD_NONBLOCK, 0);
+            ring_init(out[i].ring, 0, EFD_NONBLOCK);
+        }
+    }
 
+    CHK(clock_gettime(CLOCK_MONOTONIC, &t0));
     for (long i = 1; i < nb_sta + 1; i++) {
-        CHK(pipe(pipesdes[i])); // parent -> child
+        // to_sta is the pipe to the station, from_sta the pipe from it
+        int to_sta[2], from_sta[2];
+        if (!shm) {
+            CHK(pipe(to_sta));   // parent -> child
+            CHK(pipe(from_sta)); // child -> parent
+        }
 
-        switch (fork()) {
+        switch (pids[i] = fork()) {
 
         case -1:
             alert(1, "fork");
 
         case 0:
-            // closing unused pipes before calling child_main
-            CHK(close(pipesdes[0][0]));
-            CHK(close(pipesdes[i][1]));
+            if (shm) {
+                child_main(i, &out[i], &in[i], batch);
+                exit(EXIT_SUCCESS);
+            }
+
+            // closing unused pipes before calling child_main : the ends of
+            // the parent, and what it kept of the previous stations
+            CHK(close(to_sta[1]));
+            CHK(close(from_sta[0]));
             for (long j = 1; j < i; j++) {
-                CHK(close(pipesdes[j][0]));
-                CHK(close(pipesdes[j][1]));
+                CHK(close(in[j].fd));
+                CHK(close(out[j].fd));
             }
 
             // calling child_main
             // this function will close all pipes before exiting
-            child_main(i, pipesdes[i][0], pipesdes[0][1]);
+            struct link_s sta_in = {to_sta[0], NULL};
+            struct link_s sta_out = {from_sta[1], NULL};
+            child_main(i, &sta_in, &sta_out, batch);
 
             exit(EXIT_SUCCESS);
         }
+
+        if (shm) {
+            continue;
+        }
+
+        // closing the ends of the child, the parent never blocks on its own
+        CHK(close(to_sta[0]));
+        CHK(close(from_sta[1]));
+        in[i] = (struct link_s){from_sta[0], NULL};
+        out[i] = (struct link_s){to_sta[1], NULL};
+        CHK(fcntl(in[i].fd, F_SETFL, O_NONBLOCK));
+        CHK(fcntl(out[i].fd, F_SETFL, O_NONBLOCK));
     }
 
-    // closing unused pipes for parent before calling parent_main
-    CHK(close(pipesdes[0][1]));
-    for (long i = 1; i < nb_sta + 1; i++) {
-        CHK(close(pipesdes[i][0]));
+    // a station may terminate while frames are sent to it, its pidfd tells
+    // it to the commutator
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        alert(1, "signal");
     }
 
     // calling parent_main
     // this function will close all pipes before exiting
-    parent_main(pipesdes, nb_sta);
+    parent_main(in, out, pids, nb_sta, batch, &st);
 
     // wait for all children
     int status, exit_status = EXIT_SUCCESS;
     for (long i = 1; i < nb_sta + 1; i++) {
         CHK(wait(&status));
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) != EXIT_SUCCESS) {
+        // a station killed by a signal has failed too
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
             exit_status = EXIT_FAILURE;
         }
     }
+
+    // the stations have printed all the frames
+    CHK(clock_gettime(CLOCK_MONOTONIC, &t1));
+    if (stats) {
+        double elapsed =
+            (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        fprintf(stderr,
+                "%ld frames delivered in %.3f s (%.0f frames/s), %.1f frames "
+                "per read, %.1f per write\n",
+                st.nb_frames, elapsed, st.nb_frames / elapsed,
+                st.nb_reads ? (double)st.nb_received / st.nb_reads : 0,
+                st.nb_writes ? (double)st.nb_frames / st.nb_writes : 0);
+    }
+
+    if (shm) {
+        for (long i = 0; i < 2 * nb_sta; i++) {
+            ring_destroy(&rings[i]);
+        }
+        CHK(munmap(rings, rings_size));
+    }
     return exit_status;
 }
@@ -216,6 +216,94 @@ EOF
     return 1
   echo "OK"
 
+  ##########################################################################
+  echo -n "Test 3.3 - trafic croisé, 16384 trames par station.."
+  rm -f STA_1 STA_2 STA_3
+  ./trame 1 2 aaaa
+  ./trame 2 1 bbbb
+  ./trame 3 0 cccc
+  # chaque fichier double 14 fois, bien plus que la capacité d'un tube
+  for I in $(seq 14); do
+    for S in 1 2 3; do
+      cat STA_$S STA_$S >$TMP/sta && mv $TMP/sta STA_$S
+    done
+  done
+  timeout 10 $PROG 3 >$TMP/stdout 2>$TMP/stderr
+  RES="$?"
+  test $RES -eq 124 && echo "échec : attente infinie" && return 1
+  success $RES && return 1
+
+  test $(grep -c "^1 - 2 - 1 - bbbb$" $TMP/stdout) -ne 16384 &&
+    echo "échec : stdout non conforme" &&
+    return 1
+  test $(grep -c "^2 - 3 - 0 - cccc$" $TMP/stdout) -ne 16384 &&
+    echo "échec : stdout non conforme" &&
+    return 1
+  test $(wc -l <$TMP/stdout) -ne 65536 &&
+    echo "échec : stdout non conforme" &&
+    return 1
+  echo "OK"
+
+  ##########################################################################
+  echo -n "Test 3.4 - lots et trame à trame, sortie en tube...."
+  # mêmes fichiers : les lignes des stations ne doivent pas se mélanger
+  sort $TMP/stdout >$TMP/sortie
+  timeout 10 $PROG 3 2>$TMP/stderr | sort >$TMP/stdout2
+  ! cmp $TMP/stdout2 $TMP/sortie >/dev/null 2>&1 &&
+    echo "échec : stdout non conforme" &&
+    return 1
+  timeout 10 $PROG -u 3 >$TMP/stdout 2>$TMP/stderr
+  RES="$?"
+  test $RES -eq 124 && echo "échec : attente infinie" && return 1
+  success $RES && return 1
+
+  sort $TMP/stdout >$TMP/stdout2
+  ! cmp $TMP/stdout2 $TMP/sortie >/dev/null 2>&1 &&
+    echo "échec : stdout non conforme" &&
+    return 1
+  echo "OK"
+
+  ##########################################################################
+  echo -n "Test 3.5 - mémoire partagée, lots et trame à trame.."
+  # mêmes fichiers, les stations échangent par anneaux en mémoire partagée
+  for OPT in "" -u; do
+    timeout 10 $PROG -t shm $OPT 3 >$TMP/stdout 2>$TMP/stderr
+    RES="$?"
+    test $RES -eq 124 && echo "échec : attente infinie" && return 1
+    success $RES && return 1
+
+    sort $TMP/stdout >$TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie >/dev/null 2>&1 &&
+      echo "échec : stdout non conforme" &&
+      return 1
+  done
+  echo "OK"
+
+  ##########################################################################
+  echo -n "Test 3.6 - station sans fichier, tubes et mémoire..."
+  # la station 3 échoue aussitôt, les autres reçoivent leurs trames
+  rm -f STA_*
+  ./trame 1 2 aaaa
+  ./trame 2 3 bbbb
+  ./trame 1 0 cccc
+  cat >$TMP/sortie <<EOF
+2 - 1 - 0 - cccc
+2 - 1 - 2 - aaaa
+EOF
+  for TR in pipe shm; do
+    timeout 2 $PROG -t $TR 3 >$TMP/stdout 2>$TMP/stderr
+    RES="$?"
+    test $RES -eq 124 && echo "échec : attente infinie" && return 1
+    test $RES -ne 1 && echo "échec => code de retour != 1" && return 1
+    check_non_empty $TMP/stderr && return 1
+
+    sort $TMP/stdout >$TMP/stdout2
+    ! cmp $TMP/stdout2 $TMP/sortie >/dev/null 2>&1 &&
+      echo "échec : stdout non conforme" &&
+      return 1
+  done
+  echo "OK"
+
   rm -f STA_*
   return 0
 }